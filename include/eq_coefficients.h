@@ -0,0 +1,28 @@
+#ifndef EQ_COEFFICIENTS_H
+#define EQ_COEFFICIENTS_H
+
+/* Layout of the coefficient updates the iirequalizer element posts on the bus,
+ * shared between the plugin (C) and the application (C++).
+ *
+ * One element message named EQ_COEFFICIENTS_MESSAGE is posted per update:
+ *   "rate"  G_TYPE_UINT   sample rate the coefficients are designed for
+ *   "bands" G_TYPE_BYTES  packed array of EqCoefficientsRecord, one per changed band
+ */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define EQ_COEFFICIENTS_MESSAGE "eq-coefficients"
+
+typedef struct {
+    guint32 index; /* band number, the child is called "band<index>" */
+    gint32 type;   /* IirEqualizerBandType */
+    gdouble freq, gain, q;
+    gdouble b0, b1, b2;
+    gdouble a1, a2;
+} EqCoefficientsRecord;
+
+G_END_DECLS
+
+#endif // EQ_COEFFICIENTS_H
@@ -18,7 +18,7 @@ public:
     GstElement *bin, *id_in, *id_out;
     std::vector<GstElement*> nodes;
 
-    sigc::signal<void, std::shared_ptr<FilterInfo>> filter_updated;
+    sigc::signal<void, const std::vector<std::shared_ptr<FilterInfo>>&> filter_updated;
     sigc::signal<void, std::string, FilterChangeType, const GValue*> change_filter;
 
 private:
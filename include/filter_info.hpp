@@ -4,6 +4,7 @@
 #include <string>
 #include <gst/gst.h>
 #include <memory>
+#include <vector>
 
 class FilterInfo {
 public:
@@ -13,7 +14,7 @@ public:
     guint rate;
     std::string band;
 
-    static std::shared_ptr<FilterInfo> from_structure(const GstStructure* s);
+    static std::vector<std::shared_ptr<FilterInfo>> from_structure(const GstStructure* s);
 private:
     FilterInfo();
 };
@@ -28,7 +28,7 @@ public:
     GstElement *pipeline, *src, *spectrum, *sink;
     GstBus *bus;
 
-    void handle_coefficient_update(std::shared_ptr<FilterInfo> update);
+    void handle_coefficient_update(const std::vector<std::shared_ptr<FilterInfo>>& updates);
 
     std::string selected_filter = "";
 
@@ -33,6 +33,7 @@ struct SinkInfo {
     uint rate;
     std::string format;
     std::string active_port;
+    uint latency;
 };
 
 struct SourceInfo {
@@ -56,6 +57,15 @@ struct ClientInfo {
     std::string binary;
 };
 
+// How much audio pulsesrc and pulsesink keep buffered and what the apps sink
+// is asked for, picked with EQNIX_LATENCY
+struct LatencyProfile {
+    std::string name;
+    uint latency_us;
+};
+
+auto find_latency_profile(const std::string& name) -> const LatencyProfile*;
+
 struct AppInfo {
     std::string app_type;
     uint index;
@@ -89,6 +99,7 @@ public:
 
     ServerInfo server_info;
     std::shared_ptr<SinkInfo> apps_sink_info;
+    LatencyProfile latency_profile;
 
     std::vector<std::string> blacklist_out;
 
@@ -4,10 +4,25 @@
 #include "equalizer.hpp"
 #include "logger.hpp"
 #include "pa_manager.hpp"
+#include <atomic>
+#include <cstdint>
 #include <gio/gio.h>
 #include <gst/gst.h>
 #include <memory>
+#include <mutex>
 #include <sigc++/sigc++.h>
+#include <string>
+#include <vector>
+
+// What a streaming thread got, see schedule_stream_thread
+struct StreamThreadInfo {
+    std::string element; // the element that owns the thread
+    long tid = 0;
+    std::string policy; // SCHED_FIFO, SCHED_RR, nice or SCHED_OTHER
+    int priority = 0;   // realtime priority, or the nice value for nice
+    bool rtkit = false; // granted by RealtimeKit rather than set directly
+    std::string cpus;   // the affinity it was pinned to, empty if it wasn't
+};
 
 class Pipeline {
   public:
@@ -17,7 +32,13 @@ class Pipeline {
     logging::EqnixLogger logger = logging::EqnixLogger::create("Pipeline");
 
     bool playing = false;
-    GstClockTime state_check_timeout = 5 * GST_SECOND;
+    // dropped to idle_state by the idle timer, resumes when an app plays again
+    bool suspended = false;
+    // how long an asynchronous state change may take before it is retried
+    uint state_check_timeout = 5000; // ms
+    // ms without any app playing before the pipeline drops to idle_state, 0 never does
+    uint idle_timeout = 3000;
+    GstState idle_state = GST_STATE_PAUSED;
 
     PAManager* pam = nullptr;
 
@@ -32,15 +53,67 @@ class Pipeline {
     void update_pipeline_state();
 
     auto get_equalizer() -> std::shared_ptr<Equalizer>;
+    void log_latency();
+
+    // called from the streaming threads themselves
+    void stream_thread_entered(long tid, const std::string& element);
+    void stream_thread_left(long tid);
+    // called from whichever thread completed the state change
+    void state_reached(GstState state);
+    // called from the main loop when the pipeline settled in a state
+    void state_transition_finished();
   private:
+    // RealtimeKit and what it allows, read once. rtkit_bus is nullptr
+    // without it, the scheduling is then set directly.
+    GDBusConnection* rtkit_bus = nullptr;
+    GCancellable* rtkit_cancellable = nullptr;
+    int rtkit_max_priority = 0;
+    int rtkit_min_nice = 0;
+    gint64 rtkit_rttime_usec = 0;
+    bool rttime_limited = false;
+    std::string rt_cpus; // EQNIX_RT_CPUS, if it is valid
+
+    // streaming threads that entered and didn't leave yet, by thread id
+    std::mutex stream_threads_mutex;
+    std::vector<long> stream_threads;
+
+    void connect_rtkit();
+    auto limit_rttime() -> bool;
+    auto stream_thread_alive(long tid) -> bool;
+    // main thread only
+    void schedule_stream_thread(StreamThreadInfo info);
+    void rtkit_make_realtime(StreamThreadInfo info);
+    void stream_thread_scheduled(const StreamThreadInfo& info);
+
+    sigc::connection idle_timer;
+    // monotonic time of the pending suspend or resume request, 0 if there is none
+    std::atomic<gint64> suspend_requested{0};
+    std::atomic<gint64> resume_requested{0};
+
+    void suspend_pipeline();
+
+    // state controller, main thread only. requested_state is where the
+    // pipeline should end up, transition_target what it is on its way to.
+    GstState requested_state = GST_STATE_NULL;
+    GstState transition_target = GST_STATE_VOID_PENDING;
+    sigc::connection state_idle;
+    sigc::connection transition_timer;
+
+    void request_state(GstState state);
+    void apply_requested_state();
+    void reset_state(GstState state);
+
+    void apply_latency_profile(const LatencyProfile& profile);
+
     std::vector<std::shared_ptr<AppInfo>> apps_list;
     uint current_rate = 0;
+    std::string current_format;
     GstElement* capsfilter = nullptr;
 
     GstElement* ensure_factory_create(std::string factory, std::string name);
 
     void set_pulseaudio_props(const std::string& props);
-    void set_caps(const uint& sampling_rate);
+    void set_caps(const uint& sampling_rate, const std::string& format);
     void on_app_added(const std::shared_ptr<AppInfo>& app_info);
     void on_app_changed(const std::shared_ptr<AppInfo>& app_info);
     void on_app_removed(uint idx);
@@ -1,30 +1,41 @@
 #include "filter_info.hpp"
+#include "eq_coefficients.h"
 
 FilterInfo::FilterInfo() {
 }
 
-std::shared_ptr<FilterInfo> FilterInfo::from_structure(const GstStructure* s) {
+std::vector<std::shared_ptr<FilterInfo>> FilterInfo::from_structure(const GstStructure* s) {
     struct builder : public FilterInfo {};
-    std::shared_ptr<FilterInfo> cu = std::make_shared<builder>();
-    gst_structure_get_double(s, "b0", &cu->b0);
-    gst_structure_get_double(s, "b1", &cu->b1);
-    gst_structure_get_double(s, "b2", &cu->b2);
-    gst_structure_get_double(s, "a1", &cu->a1);
-    gst_structure_get_double(s, "a2", &cu->a2);
-    gst_structure_get_uint(s, "rate", &cu->rate);
-    gst_structure_get_int(s, "type", &cu->filtertype);
-    gst_structure_get(s,
-        "b0", G_TYPE_DOUBLE, &cu->b0,
-        "b1", G_TYPE_DOUBLE, &cu->b1,
-        "b2", G_TYPE_DOUBLE, &cu->b2,
-        "a1", G_TYPE_DOUBLE, &cu->a1,
-        "a2", G_TYPE_DOUBLE, &cu->a2,
-        "gain", G_TYPE_DOUBLE, &cu->gain,
-        "freq", G_TYPE_DOUBLE, &cu->freq,
-        "q", G_TYPE_DOUBLE, &cu->q,
-        "rate", G_TYPE_UINT, &cu->rate,
-        "type", G_TYPE_INT, &cu->filtertype,
-        nullptr);
-    cu->band = std::string(gst_structure_get_string(s, "band"));
-    return cu;
+    std::vector<std::shared_ptr<FilterInfo>> updates;
+    GBytes* bands = nullptr;
+    guint rate = 0;
+    gsize size = 0;
+
+    if (!gst_structure_has_name(s, EQ_COEFFICIENTS_MESSAGE) ||
+        !gst_structure_get(s, "rate", G_TYPE_UINT, &rate, "bands", G_TYPE_BYTES, &bands, nullptr)) {
+        return updates;
+    }
+
+    auto records = static_cast<const EqCoefficientsRecord*>(g_bytes_get_data(bands, &size));
+    auto count = size / sizeof(EqCoefficientsRecord);
+    updates.reserve(count);
+    for (gsize i = 0; i < count; ++i) {
+        const EqCoefficientsRecord& r = records[i];
+        std::shared_ptr<FilterInfo> cu = std::make_shared<builder>();
+        cu->b0 = r.b0;
+        cu->b1 = r.b1;
+        cu->b2 = r.b2;
+        cu->a1 = r.a1;
+        cu->a2 = r.a2;
+        cu->freq = r.freq;
+        cu->gain = r.gain;
+        cu->q = r.q;
+        cu->filtertype = r.type;
+        cu->rate = rate;
+        cu->band = "band" + std::to_string(r.index);
+        updates.push_back(cu);
+    }
+
+    g_bytes_unref(bands);
+    return updates;
 }
\ No newline at end of file
@@ -21,11 +21,13 @@ FrequencyResponsePlot::~FrequencyResponsePlot() {
     //
 }
 
-void FrequencyResponsePlot::handle_coefficient_update(std::shared_ptr<FilterInfo> update) {
-    logger.debug("coefficients updated for " + update->band);
-    filters.insert_or_assign(update->band, update);
-    if (samplerate != update->rate) {
-        samplerate = update->rate;
+void FrequencyResponsePlot::handle_coefficient_update(const std::vector<std::shared_ptr<FilterInfo>>& updates) {
+    for (auto& update : updates) {
+        logger.debug("coefficients updated for " + update->band);
+        filters.insert_or_assign(update->band, update);
+        if (samplerate != update->rate) {
+            samplerate = update->rate;
+        }
     }
     queue_draw();
 }
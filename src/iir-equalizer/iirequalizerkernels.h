@@ -0,0 +1,106 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __IIR_EQUALIZER_KERNELS__
+#define __IIR_EQUALIZER_KERNELS__
+
+#ifdef __SSE2__
+#include <pmmintrin.h>
+#endif
+
+#include "iirequalizer.h"
+
+/* widest vector the kernels are built for (AVX-512, 16 x gfloat) */
+#define IIR_SIMD_MAX_LANES 16
+#define IIR_SIMD_ALIGN 64
+
+typedef struct {
+    gfloat x1, x2;
+    gfloat y1, y2;
+} SecondOrderHistory;
+
+/* Scratch space a vector kernel needs per band: five broadcast
+ * coefficients and four history registers, one lane per channel.
+ */
+#define IIR_SIMD_SCRATCH_PER_BAND (9 * IIR_SIMD_MAX_LANES * sizeof(gfloat))
+
+/* Makes the FPU of the calling thread treat subnormal inputs and results as
+ * zero, so that decaying filter tails can't slow it down. The mode is per
+ * thread, every thread that runs kernels needs it.
+ */
+static inline void iir_equ_enable_flush_to_zero(void) {
+#if defined(__SSE2__)
+    guint csr = _mm_getcsr();
+
+    if (G_UNLIKELY((csr & (_MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON)) != (_MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON)))
+        _mm_setcsr(csr | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON);
+#elif defined(__aarch64__)
+    guint64 fpcr;
+
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    if (G_UNLIKELY(!(fpcr & (1 << 24))))
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));
+#endif
+}
+
+/* scalar reference implementation, always available */
+extern void iir_equ_process(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+/* the same for the other sample formats, converting on the fly */
+extern void iir_equ_process_s16(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_s32(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_f64(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+/* band-major variant of the reference, runs each band over block-size frames */
+extern void iir_equ_process_block(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+/* state space engine, runs IIR_SS_BLOCK frames through a band per step */
+extern void iir_equ_process_state_space(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+/* moves the first ramp_bands bands from ramp_coeffs towards coeffs while filtering, frame by
+ * frame, size must not cover more than ramp_remaining frames and slice all channels */
+extern void iir_equ_process_ramp(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_ramp_s16(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_ramp_s32(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_ramp_f64(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+
+/* kernel with the band loop unrolled for n_active active bands and channels
+ * interleaved F32 channels, NULL if there is none for that layout */
+extern ProcessFunc iir_equ_select_unrolled(guint n_active, guint channels);
+
+/* F32 non-interleaved buffers, frames samples starting at offset of every plane */
+extern void iir_equ_process_planar(IirEqualizer* equ, gfloat** planes, guint offset, guint frames, guint channels);
+extern void iir_equ_process_planar_ramp(IirEqualizer* equ, gfloat** planes, guint offset, guint frames, guint channels);
+
+/* Vector kernels, each one built from iirequalizer-simd.c with a different
+ * instruction set. They process up to IIR_SIMD_LANES channels of a frame
+ * at once and must only be called when the CPU supports the instruction set.
+ * slice->scratch needs IIR_SIMD_SCRATCH_PER_BAND bytes per band.
+ */
+#ifdef HAVE_IIR_SIMD_X86
+extern void iir_equ_process_sse2(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_avx2(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_avx512(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+
+/* Band parallel kernels from the same file: up to IIR_SIMD_LANES active bands
+ * of one channel run in the lanes as a time-skewed cascade, which also
+ * vectorizes mono and stereo. No scratch space needed.
+ */
+extern void iir_equ_process_bands_sse2(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_bands_avx2(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+extern void iir_equ_process_bands_avx512(IirEqualizer* equ, IirEqualizerSlice* slice, guint8* data, guint size, guint channels);
+#endif
+
+#endif /* __IIR_EQUALIZER_KERNELS__ */
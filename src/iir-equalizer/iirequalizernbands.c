@@ -27,7 +27,7 @@ static void iir_equalizer_nbands_class_init(IirEqualizerNBandsClass* klass) {
 
     g_object_class_install_property(
         gobject_class, PROP_NUM_BANDS,
-        g_param_spec_uint("num-bands", "num-bands", "number of different bands to use", 1, 64, 10, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT));
+        g_param_spec_uint("num-bands", "num-bands", "number of different bands to use", 1, IIR_EQUALIZER_MAX_BANDS, 10, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT));
 
     gst_element_class_set_static_metadata(gstelement_class, "N Band Equalizer", "Filter/Effect/Audio", "Direct Form IIR equalizer",
                                           "Benjamin Otte <otte@gnome.org>,"
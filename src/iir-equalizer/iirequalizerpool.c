@@ -0,0 +1,189 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Worker pool for high channel counts.
+ *
+ * Every buffer is one job: the streaming thread publishes it under the pool
+ * lock, bumps the generation and wakes the workers. Each worker filters its own
+ * slice of channels and the streaming thread does slice 0 meanwhile, then waits
+ * until the last worker checked in. Slices never share channels, so the history
+ * needs no locking.
+ *
+ * The streaming thread waits for the workers on every buffer, so they need its
+ * scheduling policy and priority. A realtime streaming thread would otherwise
+ * be held up by threads any desktop process can preempt. The pool is built
+ * wherever the caps or the properties are set, there is nothing to inherit
+ * from. Instead every worker posts stream-status messages from its own thread
+ * like a GstTask does, and an application that makes its streaming threads
+ * realtime from a synchronous bus handler treats the workers the same way.
+ */
+
+#include "config.h"
+
+#include "iirequalizerkernels.h"
+#include "iirequalizerpool.h"
+
+GST_DEBUG_CATEGORY_EXTERN(equalizer_debug);
+#define GST_CAT_DEFAULT equalizer_debug
+
+typedef struct {
+    IirEqualizerPool* pool;
+    guint index;
+    GThread* thread;
+} IirEqualizerWorker;
+
+struct _IirEqualizerPool {
+    IirEqualizer* equ;
+
+    IirEqualizerWorker* workers;
+    guint n_workers;
+
+    GMutex lock;
+    GCond start_cond;
+    GCond done_cond;
+    guint generation;
+    guint pending;
+    gboolean quit;
+
+    /* the current job, protected by lock */
+    ProcessFunc process;
+    guint8* data;
+    guint size;
+    guint channels;
+    guint n_slices;
+};
+
+/* Posted from the worker itself, so that a synchronous handler can tell
+ * which thread it is about.
+ */
+static void post_stream_status(IirEqualizerPool* pool, GstStreamStatusType type) {
+    GstMessage* msg = gst_message_new_stream_status(GST_OBJECT(pool->equ), type, GST_ELEMENT(pool->equ));
+
+    gst_element_post_message(GST_ELEMENT(pool->equ), msg);
+}
+
+static gpointer iir_equalizer_worker_loop(gpointer data) {
+    IirEqualizerWorker* worker = data;
+    IirEqualizerPool* pool = worker->pool;
+    guint seen = 0;
+
+    /* the FPU mode is per thread as well */
+    iir_equ_enable_flush_to_zero();
+    post_stream_status(pool, GST_STREAM_STATUS_TYPE_ENTER);
+
+    g_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->quit)
+            g_cond_wait(&pool->start_cond, &pool->lock);
+        if (pool->quit)
+            break;
+
+        seen = pool->generation;
+        if (worker->index < pool->n_slices) {
+            ProcessFunc process = pool->process;
+            guint8* data = pool->data;
+            guint size = pool->size;
+            guint channels = pool->channels;
+
+            g_mutex_unlock(&pool->lock);
+            process(pool->equ, &pool->equ->slices[worker->index], data, size, channels);
+            g_mutex_lock(&pool->lock);
+        }
+
+        if (--pool->pending == 0)
+            g_cond_signal(&pool->done_cond);
+    }
+    g_mutex_unlock(&pool->lock);
+
+    post_stream_status(pool, GST_STREAM_STATUS_TYPE_LEAVE);
+    return NULL;
+}
+
+IirEqualizerPool* iir_equalizer_pool_new(IirEqualizer* equ, guint n_workers) {
+    IirEqualizerPool* pool = g_new0(IirEqualizerPool, 1);
+    guint i;
+
+    pool->equ = equ;
+    g_mutex_init(&pool->lock);
+    g_cond_init(&pool->start_cond);
+    g_cond_init(&pool->done_cond);
+
+    pool->workers = g_new0(IirEqualizerWorker, n_workers);
+    for (i = 0; i < n_workers; i++) {
+        IirEqualizerWorker* worker = &pool->workers[i];
+        gchar name[16];
+
+        g_snprintf(name, sizeof(name), "iirequ-%u", i + 1);
+        worker->pool = pool;
+        worker->index = i + 1;
+        worker->thread = g_thread_try_new(name, iir_equalizer_worker_loop, worker, NULL);
+        if (worker->thread == NULL) {
+            GST_WARNING_OBJECT(equ, "could only start %u of %u worker threads", i, n_workers);
+            break;
+        }
+        pool->n_workers++;
+    }
+
+    GST_DEBUG_OBJECT(equ, "started %u worker threads", pool->n_workers);
+    return pool;
+}
+
+void iir_equalizer_pool_free(IirEqualizerPool* pool) {
+    guint i;
+
+    if (pool == NULL)
+        return;
+
+    g_mutex_lock(&pool->lock);
+    pool->quit = TRUE;
+    g_cond_broadcast(&pool->start_cond);
+    g_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->n_workers; i++)
+        g_thread_join(pool->workers[i].thread);
+
+    g_cond_clear(&pool->done_cond);
+    g_cond_clear(&pool->start_cond);
+    g_mutex_clear(&pool->lock);
+    g_free(pool->workers);
+    g_free(pool);
+}
+
+/* number of slices the pool can run at once, including the calling thread */
+guint iir_equalizer_pool_get_size(IirEqualizerPool* pool) { return pool->n_workers + 1; }
+
+void iir_equalizer_pool_run(IirEqualizerPool* pool, ProcessFunc process, guint8* data, guint size, guint channels, guint n_slices) {
+    g_mutex_lock(&pool->lock);
+    pool->process = process;
+    pool->data = data;
+    pool->size = size;
+    pool->channels = channels;
+    pool->n_slices = n_slices;
+    pool->pending = pool->n_workers;
+    pool->generation++;
+    g_cond_broadcast(&pool->start_cond);
+    g_mutex_unlock(&pool->lock);
+
+    process(pool->equ, &pool->equ->slices[0], data, size, channels);
+
+    g_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        g_cond_wait(&pool->done_cond, &pool->lock);
+    g_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,36 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __IIR_EQUALIZER_POOL__
+#define __IIR_EQUALIZER_POOL__
+
+#include "iirequalizer.h"
+
+/* Worker threads that process the slices of a buffer in parallel. Worker n
+ * always takes equ->slices[n], slice 0 is left to the thread calling
+ * iir_equalizer_pool_run, which returns once every slice is done. The workers
+ * post stream-status ENTER and LEAVE messages for equ from their own thread,
+ * for the application to set their scheduling like for streaming threads.
+ */
+extern IirEqualizerPool* iir_equalizer_pool_new(IirEqualizer* equ, guint n_workers);
+extern void iir_equalizer_pool_free(IirEqualizerPool* pool);
+extern guint iir_equalizer_pool_get_size(IirEqualizerPool* pool);
+extern void iir_equalizer_pool_run(IirEqualizerPool* pool, ProcessFunc process, guint8* data, guint size, guint channels, guint n_slices);
+
+#endif /* __IIR_EQUALIZER_POOL__ */
@@ -0,0 +1,95 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Times the unrolled kernels against the scalar reference and the SSE2
+ * kernel on every layout there is an unrolled kernel for, with the flat bands
+ * of the test fixture and with every third band flat on top. Prints the best
+ * of a few runs over four seconds of 48 kHz audio, in milliseconds.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "fixture.h"
+
+#define FRAMES 192000
+#define RUNS 7
+
+static gdouble time_kernel(ProcessFunc process, guint n_bands, guint channels, guint flat_every, const gfloat* input) {
+    IirEqualizer* equ = fixture_new(n_bands, channels, flat_every);
+    gsize n = (gsize)FRAMES * channels;
+    gfloat* data = g_new(gfloat, n);
+    gint64 best = G_MAXINT64;
+    guint r;
+
+    for (r = 0; r < RUNS; r++) {
+        gint64 start;
+
+        memcpy(data, input, n * sizeof(gfloat));
+        start = g_get_monotonic_time();
+        process(equ, &equ->slices[0], (guint8*)data, n * sizeof(gfloat), channels);
+        best = MIN(best, g_get_monotonic_time() - start);
+    }
+
+    g_free(data);
+    fixture_free(equ);
+    return best / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    static const guint band_counts[] = {8, 10, 15, 31};
+    gfloat* input = fixture_noise(FRAMES, 2, 1);
+    guint i, channels, flat_every;
+
+    for (i = 0; i < G_N_ELEMENTS(band_counts); i++) {
+        for (channels = 1; channels <= 2; channels++) {
+            for (flat_every = 0; flat_every <= 3; flat_every += 3) {
+                guint n_bands = band_counts[i], n_active = 0;
+                ProcessFunc unrolled;
+
+                /* as many bands as it takes for that many active ones */
+                for (; n_bands <= 3 * band_counts[i]; n_bands++) {
+                    IirEqualizer* equ = fixture_new(n_bands, channels, flat_every);
+
+                    n_active = equ->coeffs->n_active;
+                    fixture_free(equ);
+                    if (n_active == band_counts[i])
+                        break;
+                }
+                unrolled = iir_equ_select_unrolled(n_active, channels);
+                if (unrolled == NULL)
+                    continue;
+
+                printf("%2u of %2u bands active, %u channels: scalar %7.2f", n_active, n_bands, channels,
+                       time_kernel(iir_equ_process, n_bands, channels, flat_every, input));
+#ifdef HAVE_IIR_SIMD_X86
+                printf("  sse2 %7.2f", time_kernel(iir_equ_process_sse2, n_bands, channels, flat_every, input));
+#endif
+                printf("  unrolled %7.2f\n", time_kernel(unrolled, n_bands, channels, flat_every, input));
+            }
+        }
+    }
+
+    g_free(input);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "fixture.h"
+#include "iirequalizerdesign.h"
+
+#define FIXTURE_RATE 48000
+
+#define ALIGN_UP(size) (((size) + IIR_SIMD_ALIGN - 1) & ~(gsize)(IIR_SIMD_ALIGN - 1))
+
+/* Same layout as the snapshots the element publishes, one allocation with the
+ * float arrays on their own cache lines.
+ */
+static IirEqualizerSnapshot* make_snapshot(const IirEqualizerBandParams* params, guint n) {
+    IirEqualizerSnapshot* snapshot;
+    gsize head = sizeof(IirEqualizerSnapshot) + n * (sizeof(IirEqualizerCoeffs) + sizeof(guint));
+    gsize stride = ALIGN_UP(MAX(n, 1) * sizeof(gfloat));
+    gfloat *b0, *b1, *b2, *a1, *a2;
+    gfloat(*ss)[IIR_SS_COLUMNS][IIR_SS_BLOCK];
+    guint* active;
+    guint8* arrays;
+    guint i;
+
+    snapshot = g_malloc0(head + IIR_SIMD_ALIGN - 1 + 5 * stride + n * sizeof(*ss));
+    arrays = (guint8*)ALIGN_UP((guintptr)snapshot + head);
+    snapshot->b0 = b0 = (gfloat*)arrays;
+    snapshot->b1 = b1 = (gfloat*)(arrays + stride);
+    snapshot->b2 = b2 = (gfloat*)(arrays + 2 * stride);
+    snapshot->a1 = a1 = (gfloat*)(arrays + 3 * stride);
+    snapshot->a2 = a2 = (gfloat*)(arrays + 4 * stride);
+    snapshot->ss = ss = (gpointer)(arrays + 5 * stride);
+    snapshot->active = active = (guint*)&snapshot->bands[n];
+    snapshot->n_bands = n;
+
+    for (i = 0; i < n; i++) {
+        const IirEqualizerBandParams* band = &params[i];
+        IirEqualizerCoeffs* c = &snapshot->bands[i];
+
+        c->b0 = b0[i] = band->b0;
+        c->b1 = b1[i] = band->b1;
+        c->b2 = b2[i] = band->b2;
+        c->a1 = a1[i] = band->a1;
+        c->a2 = a2[i] = band->a2;
+
+        memcpy(ss[i], band->ss, sizeof(band->ss));
+
+        if (!iir_equalizer_is_identity(c))
+            active[snapshot->n_active++] = i;
+    }
+
+    return snapshot;
+}
+
+/* n_bands bands on the default spacing, designed for FIXTURE_RATE */
+static IirEqualizerSnapshot* design_snapshot(guint n_bands, guint flat_every, gdouble scale) {
+    IirEqualizerBandParams* params = g_new0(IirEqualizerBandParams, n_bands);
+    guint* indices = g_new(guint, n_bands);
+    gdouble step = pow(HIGHEST_FREQ / LOWEST_FREQ, 1.0 / n_bands);
+    gdouble freq0 = LOWEST_FREQ;
+    IirEqualizerSnapshot* snapshot;
+    guint i;
+
+    for (i = 0; i < n_bands; i++) {
+        IirEqualizerBandParams* band = &params[i];
+        gdouble freq1 = freq0 * step;
+
+        band->type = i == 0 ? BAND_TYPE_LOW_SHELF : i == n_bands - 1 ? BAND_TYPE_HIGH_SHELF : BAND_TYPE_PEAK;
+        band->freq = freq0 + (freq1 - freq0) / 2.0;
+        band->q = band->freq / (freq1 - freq0);
+        band->gain = (flat_every > 0 && i % flat_every == 0) ? 0.0 : scale * (gdouble)((gint)(i % 5) - 2) * 3.0;
+        indices[i] = i;
+        freq0 = freq1;
+    }
+    iir_equalizer_design_bands(params, indices, n_bands, FIXTURE_RATE, FALSE);
+    for (i = 0; i < n_bands; i++)
+        iir_equalizer_design_state_space(&params[i]);
+
+    snapshot = make_snapshot(params, n_bands);
+    g_free(indices);
+    g_free(params);
+    return snapshot;
+}
+
+IirEqualizer* fixture_new(guint n_bands, guint channels, guint flat_every) {
+    IirEqualizer* equ = g_malloc0(sizeof(IirEqualizer));
+    IirEqualizerSlice* slice;
+
+    g_mutex_init(&equ->bands_lock);
+    equ->coeffs = design_snapshot(n_bands, flat_every, 1.0);
+    equ->freq_band_count = n_bands;
+    equ->rate = FIXTURE_RATE;
+    equ->history_size = sizeof(SecondOrderHistory);
+    equ->history_stride = ALIGN_UP(MAX(n_bands, 1) * sizeof(SecondOrderHistory)) / sizeof(SecondOrderHistory);
+    equ->history_mem = g_malloc0(equ->history_stride * sizeof(SecondOrderHistory) * MAX(channels, 1) + IIR_SIMD_ALIGN - 1);
+    equ->history = (gpointer)ALIGN_UP((guintptr)equ->history_mem);
+    equ->history_bands = n_bands;
+    equ->history_channels = channels;
+    equ->process = iir_equ_process;
+    equ->process_ramp = iir_equ_process_ramp;
+    equ->ramp_coeffs = g_new(IirEqualizerRampCoeffs, IIR_EQUALIZER_MAX_BANDS);
+    equ->ramp_start = g_new(IirEqualizerRampCoeffs, IIR_EQUALIZER_MAX_BANDS);
+    equ->ramp_steps = g_new(IirEqualizerRampCoeffs, IIR_EQUALIZER_MAX_BANDS);
+    equ->ramp_work = g_new(IirEqualizerRampCoeffs, IIR_EQUALIZER_MAX_BANDS);
+
+    equ->slices = slice = g_new0(IirEqualizerSlice, 1);
+    equ->max_slices = 1;
+    equ->n_slices = 1;
+    equ->slices_stride = equ->history_stride;
+    slice->first_channel = 0;
+    slice->last_channel = channels;
+    slice->scratch_mem = g_malloc(IIR_SIMD_SCRATCH_PER_BAND * equ->history_stride + IIR_SIMD_ALIGN - 1);
+    slice->scratch = (gpointer)ALIGN_UP((guintptr)slice->scratch_mem);
+
+    return equ;
+}
+
+void fixture_publish(IirEqualizer* equ, guint n_bands, guint flat_every, gdouble scale) {
+    g_free(equ->pending);
+    equ->pending = design_snapshot(n_bands, flat_every, scale);
+}
+
+void fixture_free(IirEqualizer* equ) {
+    while (equ->retired != NULL) {
+        IirEqualizerSnapshot* next = equ->retired->next;
+
+        g_free(equ->retired);
+        equ->retired = next;
+    }
+    g_free(equ->pending);
+    g_free(equ->coeffs);
+    g_free(equ->slices[0].scratch_mem);
+    g_free(equ->slices[0].block_scratch);
+    g_free(equ->slices);
+    g_free(equ->history_mem);
+    g_free(equ->ramp_coeffs);
+    g_free(equ->ramp_start);
+    g_free(equ->ramp_steps);
+    g_free(equ->ramp_work);
+    g_mutex_clear(&equ->bands_lock);
+    g_free(equ);
+}
+
+gfloat* fixture_noise(guint frames, guint channels, guint32 seed) {
+    gfloat* samples = g_new(gfloat, (gsize)frames * channels);
+    gsize i;
+
+    /* xorshift, rand() differs between C libraries, and 0 is its fixed point */
+    seed = seed != 0 ? seed : 1;
+    for (i = 0; i < (gsize)frames * channels; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        samples[i] = seed / 4294967296.0f - 0.5f;
+    }
+    return samples;
+}
+
+gdouble fixture_max_diff(const gfloat* a, const gfloat* b, gsize n) {
+    gdouble max = 0.0;
+    gsize i;
+
+    for (i = 0; i < n; i++)
+        max = MAX(max, fabs((gdouble)a[i] - b[i]));
+    return max;
+}
@@ -0,0 +1,47 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __IIR_EQUALIZER_FIXTURE__
+#define __IIR_EQUALIZER_FIXTURE__
+
+#include "iirequalizerkernels.h"
+
+/* An equalizer that is only good for calling kernels on: n_bands bands on the
+ * default spacing with gains between -6 and +6 dB, designed for 48 kHz, and
+ * history for channels channels in a single slice. With flat_every > 0 every
+ * flat_every-th band gets 0 dB and is left out of the active bands. It is not
+ * a GObject, the element machinery around the kernels is never run, but
+ * iir_equalizer_process_buffer() can run it with ramp-length and
+ * silence-threshold set by hand.
+ */
+extern IirEqualizer* fixture_new(guint n_bands, guint channels, guint flat_every);
+extern void fixture_free(IirEqualizer* equ);
+
+/* Publishes n_bands bands like fixture_new() designs them with every gain
+ * multiplied by scale, as the control side would after a property change.
+ */
+extern void fixture_publish(IirEqualizer* equ, guint n_bands, guint flat_every, gdouble scale);
+
+/* frames frames of channels channels of white noise in [-0.5, 0.5), the same for the same seed */
+extern gfloat* fixture_noise(guint frames, guint channels, guint32 seed);
+
+/* largest absolute difference between n samples of a and b */
+extern gdouble fixture_max_diff(const gfloat* a, const gfloat* b, gsize n);
+
+#endif /* __IIR_EQUALIZER_FIXTURE__ */
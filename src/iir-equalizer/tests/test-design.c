@@ -0,0 +1,208 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks the batch designer against the band at a time design it replaced,
+ * which lives on below as the reference. Without fast-design the coefficients
+ * must come out the same to the bit, with it close enough that the response
+ * doesn't change audibly.
+ */
+
+#include "config.h"
+
+#include <complex.h>
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "iirequalizerdesign.h"
+
+#define N_BANDS 1024
+#define N_ROUNDS 20
+
+/* measured: 4.0e-10 and 8.8e-9 dB */
+#define FAST_COEFF_TOLERANCE 1e-9
+#define FAST_RESPONSE_TOLERANCE_DB 1e-7
+
+static const gint rates[] = {22050, 44100, 48000, 96000, 192000};
+
+/* the design as setup_peak_filter() and the shelf versions did it */
+
+static gdouble reference_omega(gdouble freq, gint rate) {
+    if (freq / rate >= 0.5)
+        return G_PI;
+    if (freq <= 0.0)
+        return 0.0;
+    return 2.0 * G_PI * (freq / rate);
+}
+
+static void reference_design(IirEqualizerBandParams* band, gint rate) {
+    gdouble gain = pow(10.0, band->gain / 40.0);
+    gdouble omega = reference_omega(band->freq, rate);
+    gdouble w = band->freq / band->q;
+    gdouble bw, alpha, delta, a0, egp, egm;
+
+    if (w / rate >= 0.5) {
+        bw = G_PI - 0.00000001;
+    } else if (w <= 0.0) {
+        band->b0 = 1.0;
+        band->b1 = 0.0;
+        band->b2 = 0.0;
+        band->a1 = 0.0;
+        band->a2 = 0.0;
+        return;
+    } else {
+        bw = 2.0 * G_PI * (w / rate);
+    }
+
+    alpha = tan(bw / 2.0);
+
+    if (band->type == BAND_TYPE_PEAK) {
+        gdouble alpha1 = alpha * gain;
+        gdouble alpha2 = alpha / gain;
+
+        a0 = (1.0 + alpha2);
+
+        band->b0 = (1 + alpha1) / a0;
+        band->b1 = (-2 * cos(omega)) / a0;
+        band->b2 = (1 - alpha1) / a0;
+        band->a1 = (-2 * cos(omega)) / a0;
+        band->a2 = (1.0 - alpha2) / a0;
+        return;
+    }
+
+    egm = gain - 1.0;
+    egp = gain + 1.0;
+    delta = 2.0 * sqrt(gain) * alpha;
+
+    if (band->type == BAND_TYPE_LOW_SHELF) {
+        a0 = egp + egm * cos(omega) + delta;
+
+        band->b0 = ((egp - egm * cos(omega) + delta) * gain) / a0;
+        band->b1 = ((egm - egp * cos(omega)) * 2.0 * gain) / a0;
+        band->b2 = ((egp - egm * cos(omega) - delta) * gain) / a0;
+        band->a1 = -((egm + egp * cos(omega)) * 2.0) / a0;
+        band->a2 = ((egp + egm * cos(omega) - delta)) / a0;
+    } else {
+        a0 = egp - egm * cos(omega) + delta;
+
+        band->b0 = ((egp + egm * cos(omega) + delta) * gain) / a0;
+        band->b1 = ((egm + egp * cos(omega)) * -2.0 * gain) / a0;
+        band->b2 = ((egp + egm * cos(omega) - delta) * gain) / a0;
+        band->a1 = -((egm - egp * cos(omega)) * -2.0) / a0;
+        band->a2 = ((egp - egm * cos(omega) - delta)) / a0;
+    }
+}
+
+/* Random bands across the whole range of the properties, with some of them
+ * flat, at 0 Hz or above Nyquist.
+ */
+static void random_bands(GRand* rand, IirEqualizerBandParams* bands, guint* indices) {
+    guint i;
+
+    for (i = 0; i < N_BANDS; i++) {
+        IirEqualizerBandParams* band = &bands[i];
+
+        band->type = g_rand_int_range(rand, 0, 3);
+        band->gain = g_rand_int_range(rand, 0, 8) == 0 ? 0.0 : g_rand_double_range(rand, -24.0, 24.0);
+        band->freq = 10.0 * pow(3000.0, g_rand_double(rand));
+        if (g_rand_int_range(rand, 0, 50) == 0)
+            band->freq = 0.0;
+        else if (g_rand_int_range(rand, 0, 50) == 0)
+            band->freq = 30000.0;
+        band->q = pow(10.0, g_rand_double_range(rand, -2.0, 2.0));
+        indices[i] = i;
+    }
+}
+
+static gdouble response_db(const IirEqualizerBandParams* band, gdouble omega) {
+    double complex z = cexp(-I * omega);
+
+    return 20.0 * log10(cabs((band->b0 + band->b1 * z + band->b2 * z * z) / (1.0 + band->a1 * z + band->a2 * z * z)));
+}
+
+static gboolean is_flat(const IirEqualizerBandParams* band) {
+    return band->b0 == 1.0 && band->b1 == band->a1 && band->b2 == band->a2;
+}
+
+static void run_design(gboolean fast) {
+    IirEqualizerBandParams* expected = g_new0(IirEqualizerBandParams, N_BANDS);
+    IirEqualizerBandParams* actual = g_new0(IirEqualizerBandParams, N_BANDS);
+    guint* indices = g_new(guint, N_BANDS);
+    GRand* rand = g_rand_new_with_seed(7);
+    guint r, round, i, k;
+
+    for (r = 0; r < G_N_ELEMENTS(rates); r++) {
+        for (round = 0; round < N_ROUNDS; round++) {
+            random_bands(rand, expected, indices);
+            memcpy(actual, expected, N_BANDS * sizeof(IirEqualizerBandParams));
+
+            for (i = 0; i < N_BANDS; i++)
+                reference_design(&expected[i], rates[r]);
+            iir_equalizer_design_bands(actual, indices, N_BANDS, rates[r], fast);
+
+            for (i = 0; i < N_BANDS; i++) {
+                const gdouble* x = &expected[i].b0;
+                const gdouble* y = &actual[i].b0;
+
+                /* b0, b1, b2, a1, a2 follow each other */
+                for (k = 0; k < 5; k++) {
+                    if (fast)
+                        g_assert_cmpfloat(fabs(x[k] - y[k]), <=, FAST_COEFF_TOLERANCE);
+                    else
+                        g_assert_cmpfloat(x[k], ==, y[k]);
+                }
+
+                /* flat bands are left out of the active ones */
+                if (is_flat(&expected[i]))
+                    g_assert_true(is_flat(&actual[i]));
+
+                if (!fast)
+                    continue;
+                for (k = 1; k < 8; k++) {
+                    gdouble omega = G_PI * k / 8;
+
+                    g_assert_cmpfloat(fabs(response_db(&expected[i], omega) - response_db(&actual[i], omega)), <=, FAST_RESPONSE_TOLERANCE_DB);
+                }
+            }
+        }
+    }
+
+    g_rand_free(rand);
+    g_free(indices);
+    g_free(actual);
+    g_free(expected);
+}
+
+static void test_exact(void) {
+    run_design(FALSE);
+}
+
+static void test_fast(void) {
+    run_design(TRUE);
+}
+
+int main(int argc, char** argv) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/iirequalizer/design/exact", test_exact);
+    g_test_add_func("/iirequalizer/design/fast", test_fast);
+
+    return g_test_run();
+}
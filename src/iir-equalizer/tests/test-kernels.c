@@ -0,0 +1,794 @@
+/* GStreamer IIR equalizer
+ * Copyright (C) <2020> Tyler Snedigar <snedigart@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Runs every kernel against the scalar reference iir_equ_process on the same
+ * bands and input, over consecutive buffers so that the history they leave
+ * behind is checked as well. The tests after them feed the fixture through
+ * iir_equalizer_process_buffer() and publish new coefficients in between or
+ * from the sync of a bound property, the way transform_ip and the control
+ * side do.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "fixture.h"
+
+/* Kernels that evaluate the recurrence in the same order as the reference
+ * differ only where the compiler reorders, so they get SAME_ORDER_TOLERANCE.
+ * The FMA kernels round each multiply-add once and the unrolled kernels pair
+ * the terms differently. The poles of the lowest sections sit close to the
+ * unit circle and amplify that into about 1e-3 on this input. The state space
+ * engine runs a block matrix instead of the recurrence and strays the most.
+ */
+#define SAME_ORDER_TOLERANCE 1e-6
+#define REORDERED_TOLERANCE 3e-3
+#define STATE_SPACE_TOLERANCE 5e-3
+
+#define N_BANDS 12
+#define FRAMES 1000
+#define N_BUFFERS 3
+
+/* band counts tried on the unrolled kernels, with and without flat bands */
+#define MAX_UNROLLED_BANDS 48
+
+/* The ramp tests play a tone through a change of coefficients. A click is a
+ * third difference bigger than the ones the tone makes before and after the
+ * change by more than CLICK_FACTOR. The tone's own third differences are
+ * (2 pi TONE_FREQ / rate)^3 of its level while a jump comes through whole, so
+ * switching coefficients without a ramp goes over it several times.
+ */
+#define RAMP_LENGTH 2048
+#define TONE_FREQ 1000.0
+#define CLICK_FACTOR 1.1
+/* the last frame of a ramp rounds start + RAMP_LENGTH steps once */
+#define RAMP_END_TOLERANCE 1e-6
+
+/* The silence tests let a burst of noise ring out in zero buffers of
+ * SILENCE_CHUNK frames, an odd size so that is_zero() ends on single bytes.
+ * Skipping drops tails below -120 dB, which the bands amplify by their peak
+ * gain of 6 dB at most on the way out.
+ */
+#define SILENCE_CHUNK 250
+#define SILENCE_MAX_CHUNKS 400
+#define SILENCE_THRESHOLD_DB -120
+#define SILENCE_TOLERANCE 1e-5
+
+/* The control-interval tests run CONTROL_FRAMES frames stamped
+ * CONTROL_TIMESTAMP with a bound property, in chunks that don't all divide it.
+ */
+#define CONTROL_FRAMES 1000
+#define CONTROL_TIMESTAMP (3 * GST_SECOND)
+#define CONTROL_MAX_SYNCS 64
+
+typedef struct {
+    const gchar* name;
+    ProcessFunc process;
+    /* the instruction set the kernel needs, NULL for none */
+    const gchar* isa;
+    /* the block kernel reads block-size from the element */
+    guint block_size;
+    gdouble tolerance;
+} KernelVariant;
+
+static const KernelVariant variants[] = {
+    {"block", iir_equ_process_block, NULL, 64, SAME_ORDER_TOLERANCE},
+    {"block-1", iir_equ_process_block, NULL, 1, SAME_ORDER_TOLERANCE},
+    {"state-space", iir_equ_process_state_space, NULL, 0, STATE_SPACE_TOLERANCE},
+#ifdef HAVE_IIR_SIMD_X86
+    {"sse2", iir_equ_process_sse2, "sse2", 0, SAME_ORDER_TOLERANCE},
+    {"avx2", iir_equ_process_avx2, "avx2", 0, REORDERED_TOLERANCE},
+    {"avx512", iir_equ_process_avx512, "avx512f", 0, REORDERED_TOLERANCE},
+    {"bands-sse2", iir_equ_process_bands_sse2, "sse2", 0, SAME_ORDER_TOLERANCE},
+    {"bands-avx2", iir_equ_process_bands_avx2, "avx2", 0, REORDERED_TOLERANCE},
+    {"bands-avx512", iir_equ_process_bands_avx512, "avx512f", 0, REORDERED_TOLERANCE},
+#endif
+};
+
+static const guint channel_counts[] = {1, 2, 3, 4, 5, 8, 9, 16, 17, 32};
+
+static gboolean cpu_supports(const gchar* isa) {
+#ifdef HAVE_IIR_SIMD_X86
+    __builtin_cpu_init();
+
+    /* the AVX2 builds are compiled with -mfma as well */
+    if (g_strcmp0(isa, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+    if (g_strcmp0(isa, "avx2") == 0)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (g_strcmp0(isa, "avx512f") == 0)
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma");
+#endif
+    return isa == NULL;
+}
+
+static void compare_with_scalar(const KernelVariant* variant, guint n_bands, guint channels, guint flat_every) {
+    IirEqualizer* reference = fixture_new(n_bands, channels, flat_every);
+    IirEqualizer* equ = fixture_new(n_bands, channels, flat_every);
+    gsize n = (gsize)FRAMES * channels;
+    guint b;
+
+    equ->block_size = variant->block_size;
+
+    for (b = 0; b < N_BUFFERS; b++) {
+        gfloat* expected = fixture_noise(FRAMES, channels, b + 1);
+        gfloat* actual = g_new(gfloat, n);
+        gdouble diff;
+
+        memcpy(actual, expected, n * sizeof(gfloat));
+        iir_equ_process(reference, &reference->slices[0], (guint8*)expected, n * sizeof(gfloat), channels);
+        variant->process(equ, &equ->slices[0], (guint8*)actual, n * sizeof(gfloat), channels);
+
+        diff = fixture_max_diff(expected, actual, n);
+        if (diff > variant->tolerance)
+            g_test_message("%s, %u bands, %u channels, every %u-th band flat, buffer %u: max difference %g", variant->name, n_bands, channels,
+                           flat_every, b, diff);
+        g_assert_cmpfloat(diff, <=, variant->tolerance);
+
+        g_free(actual);
+        g_free(expected);
+    }
+
+    fixture_free(equ);
+    fixture_free(reference);
+}
+
+static void test_variant(gconstpointer data) {
+    const KernelVariant* variant = data;
+    guint i;
+
+    if (!cpu_supports(variant->isa)) {
+        g_test_skip("the CPU can't run this kernel");
+        return;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(channel_counts); i++) {
+        compare_with_scalar(variant, N_BANDS, channel_counts[i], 0);
+        /* only the active bands run */
+        compare_with_scalar(variant, N_BANDS, channel_counts[i], 3);
+    }
+}
+
+/* The unrolled kernels only exist for some layouts, picked by the number of
+ * active bands. Every band count up to MAX_UNROLLED_BANDS runs into each of
+ * them a few times, also with flat bands in between the active ones.
+ */
+static void test_unrolled(void) {
+    guint n_bands, channels, flat_every, tested = 0, tested_flat = 0;
+
+    for (n_bands = 1; n_bands <= MAX_UNROLLED_BANDS; n_bands++) {
+        for (channels = 1; channels <= 2; channels++) {
+            for (flat_every = 0; flat_every <= 3; flat_every += 3) {
+                IirEqualizer* equ = fixture_new(n_bands, channels, flat_every);
+                KernelVariant variant = {"unrolled", iir_equ_select_unrolled(equ->coeffs->n_active, channels), NULL, 0, REORDERED_TOLERANCE};
+                gboolean flat = equ->coeffs->n_active < n_bands;
+
+                fixture_free(equ);
+                if (variant.process == NULL)
+                    continue;
+
+                compare_with_scalar(&variant, n_bands, channels, flat_every);
+                tested++;
+                if (flat)
+                    tested_flat++;
+            }
+        }
+    }
+
+    g_assert_cmpuint(tested, >, 0);
+    g_assert_cmpuint(tested_flat, >, 0);
+}
+
+/* frames frames of a sine at freq, the same on every channel */
+static gfloat* tone(guint frames, guint channels, gdouble freq, gdouble amplitude) {
+    gfloat* samples = g_new(gfloat, (gsize)frames * channels);
+    guint i, c;
+
+    for (i = 0; i < frames; i++)
+        for (c = 0; c < channels; c++)
+            samples[(gsize)i * channels + c] = amplitude * sin(2.0 * G_PI * freq * i / 48000.0);
+    return samples;
+}
+
+/* largest third difference over frames [from, to) of samples */
+static gdouble max_step(const gfloat* samples, guint channels, gsize from, gsize to) {
+    gdouble max = 0.0;
+    gsize i;
+
+    for (i = from * channels; i + 3 * channels < to * channels; i++)
+        max = MAX(max, fabs((gdouble)samples[i + 3 * channels] - 3.0 * samples[i + 2 * channels] + 3.0 * samples[i + channels] - samples[i]));
+    return max;
+}
+
+/* frames interleaved F32 frames at samples through the element's buffer path */
+static guint run_frames(IirEqualizer* equ, gfloat* samples, guint frames, guint channels) {
+    return iir_equalizer_process_buffer(equ, (guint8*)samples, NULL, channels * sizeof(gfloat), frames, channels, equ->rate, 0, FALSE);
+}
+
+/* Whether a tone through a change that was published at frame switch_frame
+ * steps further around the change than it does before and after.
+ */
+static void assert_no_click(const gfloat* samples, guint channels, gsize switch_frame, gsize settled_frame, gsize frames) {
+    gdouble before = max_step(samples, channels, switch_frame / 2, switch_frame);
+    gdouble after = max_step(samples, channels, settled_frame, frames);
+    gdouble around = max_step(samples, channels, switch_frame - 1, settled_frame);
+
+    g_assert_cmpfloat(around, <=, CLICK_FACTOR * MAX(before, after));
+}
+
+static void assert_ramp_reached(IirEqualizer* equ) {
+    const IirEqualizerSnapshot* coeffs = equ->coeffs;
+    guint f;
+
+    g_assert_cmpuint(equ->ramp_remaining, ==, 0);
+    for (f = 0; f < coeffs->n_bands; f++) {
+        g_assert_cmpfloat(fabsf(equ->ramp_coeffs[f].b0 - coeffs->b0[f]), <=, RAMP_END_TOLERANCE);
+        g_assert_cmpfloat(fabsf(equ->ramp_coeffs[f].b1 - coeffs->b1[f]), <=, RAMP_END_TOLERANCE);
+        g_assert_cmpfloat(fabsf(equ->ramp_coeffs[f].b2 - coeffs->b2[f]), <=, RAMP_END_TOLERANCE);
+        g_assert_cmpfloat(fabsf(equ->ramp_coeffs[f].a1 - coeffs->a1[f]), <=, RAMP_END_TOLERANCE);
+        g_assert_cmpfloat(fabsf(equ->ramp_coeffs[f].a2 - coeffs->a2[f]), <=, RAMP_END_TOLERANCE);
+    }
+}
+
+/* Turns every boost into a cut while a tone plays, once in a single buffer
+ * and once in buffers that end in the middle of the ramp. Both must come out
+ * the same, without a click, and end on the new coefficients.
+ */
+static void test_ramp(void) {
+    static const guint chunks[] = {1, 100, 1000, 2 * RAMP_LENGTH};
+    guint frames = 4 * RAMP_LENGTH, channels = 2, offset, i;
+    IirEqualizer* whole = fixture_new(N_BANDS, channels, 0);
+    IirEqualizer* split = fixture_new(N_BANDS, channels, 0);
+    gfloat* expected = tone(frames, channels, TONE_FREQ, 0.25);
+    gfloat* actual = g_new(gfloat, (gsize)frames * channels);
+
+    memcpy(actual, expected, (gsize)frames * channels * sizeof(gfloat));
+    whole->ramp_length = split->ramp_length = RAMP_LENGTH;
+    run_frames(whole, expected, RAMP_LENGTH, channels);
+    run_frames(split, actual, RAMP_LENGTH, channels);
+
+    fixture_publish(whole, N_BANDS, 0, -1.0);
+    fixture_publish(split, N_BANDS, 0, -1.0);
+    run_frames(whole, expected + RAMP_LENGTH * channels, frames - RAMP_LENGTH, channels);
+    for (i = 0, offset = RAMP_LENGTH; offset < frames; i++) {
+        guint chunk = MIN(chunks[i % G_N_ELEMENTS(chunks)], frames - offset);
+
+        run_frames(split, actual + (gsize)offset * channels, chunk, channels);
+        offset += chunk;
+        if (offset < 2 * RAMP_LENGTH)
+            g_assert_cmpuint(split->ramp_remaining, ==, 2 * RAMP_LENGTH - offset);
+    }
+
+    g_assert_cmpfloat(fixture_max_diff(expected, actual, (gsize)frames * channels), ==, 0.0);
+    assert_no_click(expected, channels, RAMP_LENGTH, 3 * RAMP_LENGTH, frames);
+    assert_ramp_reached(whole);
+    assert_ramp_reached(split);
+
+    g_free(actual);
+    g_free(expected);
+    fixture_free(split);
+    fixture_free(whole);
+}
+
+/* A change that arrives while a ramp runs takes over from where that one is. */
+static void test_ramp_restart(void) {
+    guint frames = 4 * RAMP_LENGTH, channels = 1;
+    IirEqualizer* equ = fixture_new(N_BANDS, channels, 0);
+    gfloat* samples = tone(frames, channels, TONE_FREQ, 0.25);
+
+    equ->ramp_length = RAMP_LENGTH;
+    run_frames(equ, samples, RAMP_LENGTH, channels);
+    fixture_publish(equ, N_BANDS, 0, -1.0);
+    run_frames(equ, samples + RAMP_LENGTH, RAMP_LENGTH / 2, channels);
+    fixture_publish(equ, N_BANDS, 0, 0.5);
+    run_frames(equ, samples + 3 * RAMP_LENGTH / 2, frames - 3 * RAMP_LENGTH / 2, channels);
+
+    assert_no_click(samples, channels, RAMP_LENGTH, 3 * RAMP_LENGTH, frames);
+    assert_ramp_reached(equ);
+
+    g_free(samples);
+    fixture_free(equ);
+}
+
+typedef enum { FORMAT_S16, FORMAT_S32, FORMAT_F64 } SampleFormat;
+
+typedef struct {
+    const gchar* name;
+    SampleFormat format;
+    ProcessFunc process;
+    ProcessFunc process_ramp;
+    gsize sample_size;
+} FormatVariant;
+
+static const FormatVariant formats[] = {
+    {"s16", FORMAT_S16, iir_equ_process_s16, iir_equ_process_ramp_s16, sizeof(gint16)},
+    {"s32", FORMAT_S32, iir_equ_process_s32, iir_equ_process_ramp_s32, sizeof(gint32)},
+    {"f64", FORMAT_F64, iir_equ_process_f64, iir_equ_process_ramp_f64, sizeof(gdouble)},
+};
+
+/* Stores sample i in format and returns the F32 sample it stands for, which
+ * is exactly what the kernels convert it to.
+ */
+static gfloat store_sample(SampleFormat format, guint8* data, gsize i, gfloat v) {
+    switch (format) {
+    case FORMAT_S16:
+        ((gint16*)data)[i] = (gint16)CLAMP(rint(v * 32768.0), G_MININT16, G_MAXINT16);
+        return ((gint16*)data)[i] / 32768.0f;
+    case FORMAT_S32:
+        ((gint32*)data)[i] = (gint32)CLAMP(rint(v * 2147483648.0), G_MININT32, G_MAXINT32);
+        return (gfloat)((gint32*)data)[i] / 2147483648.0f;
+    default:
+        ((gdouble*)data)[i] = v;
+        return v;
+    }
+}
+
+static gdouble load_sample(SampleFormat format, const guint8* data, gsize i) {
+    switch (format) {
+    case FORMAT_S16:
+        return ((const gint16*)data)[i];
+    case FORMAT_S32:
+        return ((const gint32*)data)[i];
+    default:
+        return ((const gdouble*)data)[i];
+    }
+}
+
+/* an F32 result as the last band stores it in format, rounded and clipped */
+static gdouble convert_sample(SampleFormat format, gfloat v, gboolean* clipped) {
+    gdouble scaled;
+
+    switch (format) {
+    case FORMAT_S16:
+        scaled = rint(v * 32768.0);
+        *clipped |= scaled > G_MAXINT16 || scaled < G_MININT16;
+        return CLAMP(scaled, G_MININT16, G_MAXINT16);
+    case FORMAT_S32:
+        scaled = rint(v * 2147483648.0);
+        *clipped |= scaled > G_MAXINT32 || scaled < G_MININT32;
+        return CLAMP(scaled, G_MININT32, G_MAXINT32);
+    default:
+        return v;
+    }
+}
+
+/* The formats only differ from F32 where samples enter the first band and
+ * leave the last one, so full scale noise through a ramp has to come out as
+ * the F32 result rounded and clipped to the format, to the bit.
+ */
+static void test_format(gconstpointer data) {
+    const FormatVariant* variant = data;
+    guint frames = 2 * RAMP_LENGTH, i;
+
+    for (i = 0; i < G_N_ELEMENTS(channel_counts); i++) {
+        guint channels = channel_counts[i];
+        gsize k, n = (gsize)frames * channels;
+        IirEqualizer* reference = fixture_new(N_BANDS, channels, 0);
+        IirEqualizer* equ = fixture_new(N_BANDS, channels, 0);
+        gfloat* expected = fixture_noise(frames, channels, i + 1);
+        guint8* actual = g_malloc(n * variant->sample_size);
+        gsize frame_size = channels * variant->sample_size;
+        gboolean clipped = FALSE;
+
+        for (k = 0; k < n; k++)
+            expected[k] = store_sample(variant->format, actual, k, 2.0f * expected[k]);
+
+        equ->process = variant->process;
+        equ->process_ramp = variant->process_ramp;
+        reference->ramp_length = equ->ramp_length = RAMP_LENGTH / 2;
+
+        run_frames(reference, expected, frames / 2, channels);
+        iir_equalizer_process_buffer(equ, actual, NULL, frame_size, frames / 2, channels, equ->rate, 0, FALSE);
+        fixture_publish(reference, N_BANDS, 0, -1.0);
+        fixture_publish(equ, N_BANDS, 0, -1.0);
+        run_frames(reference, expected + n / 2, frames / 2, channels);
+        iir_equalizer_process_buffer(equ, actual + n / 2 * variant->sample_size, NULL, frame_size, frames / 2, channels, equ->rate, 0, FALSE);
+
+        for (k = 0; k < n; k++)
+            g_assert_cmpfloat(load_sample(variant->format, actual, k), ==, convert_sample(variant->format, expected[k], &clipped));
+        /* the integer formats saw samples beyond full scale */
+        g_assert_true(clipped == (variant->format != FORMAT_F64));
+
+        g_free(actual);
+        g_free(expected);
+        fixture_free(equ);
+        fixture_free(reference);
+    }
+}
+
+/* Non-interleaved buffers run every band over a whole plane instead of frame
+ * by frame, in the same order per sample. Through a ramp that ends in the
+ * middle of a buffer they have to match interleaved ones.
+ */
+static void test_planar(void) {
+    guint frames = 3 * RAMP_LENGTH / 2, i, c;
+
+    for (i = 0; i < G_N_ELEMENTS(channel_counts); i++) {
+        guint channels = channel_counts[i];
+        gsize k, n = (gsize)frames * channels;
+        IirEqualizer* reference = fixture_new(N_BANDS, channels, 3);
+        IirEqualizer* equ = fixture_new(N_BANDS, channels, 3);
+        gfloat* expected = fixture_noise(frames, channels, i + 1);
+        gfloat* actual = g_new(gfloat, n);
+        gfloat** planes = g_new(gfloat*, channels);
+        gfloat** rest = g_new(gfloat*, channels);
+
+        for (c = 0; c < channels; c++) {
+            planes[c] = actual + (gsize)c * frames;
+            rest[c] = planes[c] + frames / 3;
+            for (k = 0; k < frames; k++)
+                planes[c][k] = expected[k * channels + c];
+        }
+
+        reference->ramp_length = equ->ramp_length = RAMP_LENGTH / 2;
+        run_frames(reference, expected, frames / 3, channels);
+        iir_equalizer_process_buffer(equ, NULL, planes, channels * sizeof(gfloat), frames / 3, channels, equ->rate, 0, FALSE);
+        fixture_publish(reference, N_BANDS, 3, -1.0);
+        fixture_publish(equ, N_BANDS, 3, -1.0);
+        run_frames(reference, expected + n / 3, frames - frames / 3, channels);
+        iir_equalizer_process_buffer(equ, NULL, rest, channels * sizeof(gfloat), frames - frames / 3, channels, equ->rate, 0, FALSE);
+
+        for (c = 0; c < channels; c++)
+            for (k = 0; k < frames; k++)
+                g_assert_cmpfloat(fabs((gdouble)planes[c][k] - expected[k * channels + c]), <=, SAME_ORDER_TOLERANCE);
+
+        g_free(rest);
+        g_free(planes);
+        g_free(actual);
+        g_free(expected);
+        fixture_free(equ);
+        fixture_free(reference);
+    }
+}
+
+/* num-bands from from_bands to to_bands while a tone plays, with the bands
+ * spread over the new count like num-bands does as long as none was set.
+ * Removed bands fade out and keep their history until the ramp is over,
+ * added ones fade in from flat.
+ */
+static void change_num_bands(guint from_bands, guint to_bands) {
+    guint frames = 4 * RAMP_LENGTH, channels = 2, offset, f;
+    IirEqualizer* equ = fixture_new(from_bands, channels, 0);
+    gfloat* samples = tone(frames, channels, TONE_FREQ, 0.25);
+
+    equ->ramp_length = RAMP_LENGTH;
+    run_frames(equ, samples, RAMP_LENGTH, channels);
+    fixture_publish(equ, to_bands, 0, 1.0);
+
+    for (offset = RAMP_LENGTH; offset < frames; offset += RAMP_LENGTH / 4) {
+        run_frames(equ, samples + (gsize)offset * channels, RAMP_LENGTH / 4, channels);
+        if (offset < 2 * RAMP_LENGTH)
+            g_assert_cmpuint(equ->history_bands, ==, MAX(from_bands, to_bands));
+        else
+            g_assert_cmpuint(equ->history_bands, ==, to_bands);
+    }
+
+    for (f = from_bands; f < to_bands; f++) {
+        g_assert_cmpfloat(equ->ramp_start[f].b0, ==, 1.0f);
+        g_assert_cmpfloat(equ->ramp_start[f].b1, ==, 0.0f);
+        g_assert_cmpfloat(equ->ramp_start[f].b2, ==, 0.0f);
+        g_assert_cmpfloat(equ->ramp_start[f].a1, ==, 0.0f);
+        g_assert_cmpfloat(equ->ramp_start[f].a2, ==, 0.0f);
+    }
+    assert_no_click(samples, channels, RAMP_LENGTH, 3 * RAMP_LENGTH, frames);
+    assert_ramp_reached(equ);
+
+    g_free(samples);
+    fixture_free(equ);
+}
+
+static void test_num_bands_shrink(void) {
+    change_num_bands(10, 8);
+}
+
+/* beyond the room the fixture's history has */
+static void test_num_bands_grow(void) {
+    change_num_bands(8, 12);
+}
+
+/* largest value in the history of all bands and channels */
+static gfloat history_level(IirEqualizer* equ) {
+    guint c, i, n = equ->history_bands * (sizeof(SecondOrderHistory) / sizeof(gfloat));
+    gfloat max = 0.0f;
+
+    for (c = 0; c < equ->history_channels; c++) {
+        const gfloat* values = (const gfloat*)((SecondOrderHistory*)equ->history + c * equ->history_stride);
+
+        for (i = 0; i < n; i++)
+            max = MAX(max, fabsf(values[i]));
+    }
+    return max;
+}
+
+/* SILENCE_CHUNK frames of samples through equ, which skips silence, and
+ * through reference, which doesn't. Returns how many frames equ skipped.
+ */
+static guint run_silence_chunk(IirEqualizer* equ, IirEqualizer* reference, const gfloat* samples, guint channels, gboolean gap) {
+    gsize n = (gsize)SILENCE_CHUNK * channels;
+    gfloat* actual = g_new(gfloat, n);
+    gfloat* expected = g_new(gfloat, n);
+    gsize frame_size = channels * sizeof(gfloat);
+    guint skipped;
+
+    memcpy(actual, samples, n * sizeof(gfloat));
+    memcpy(expected, samples, n * sizeof(gfloat));
+
+    skipped = iir_equalizer_process_buffer(equ, (guint8*)actual, NULL, frame_size, SILENCE_CHUNK, channels, equ->rate, 0, gap);
+    g_assert_cmpuint(iir_equalizer_process_buffer(reference, (guint8*)expected, NULL, frame_size, SILENCE_CHUNK, channels, reference->rate, 0, gap), ==, 0);
+    g_assert_true(skipped == 0 || skipped == SILENCE_CHUNK);
+
+    if (skipped > 0)
+        g_assert_cmpmem(actual, n * sizeof(gfloat), samples, n * sizeof(gfloat));
+    g_assert_cmpfloat(fixture_max_diff(expected, actual, n), <=, SILENCE_TOLERANCE);
+
+    g_free(expected);
+    g_free(actual);
+    return skipped;
+}
+
+/* Zero buffers after a sound run while the filters ring and are only
+ * skipped once every tail is below silence-threshold, from then on without
+ * touching them. With gap the zero buffers are flagged as gaps as well.
+ */
+static void ring_out(IirEqualizer* equ, IirEqualizer* reference, const gfloat* zeros, guint channels, gboolean gap) {
+    guint i, ringing = 0;
+
+    for (i = 0; i < SILENCE_MAX_CHUNKS; i++) {
+        gboolean decayed = history_level(equ) < pow(10.0, SILENCE_THRESHOLD_DB / 20.0);
+        guint skipped = run_silence_chunk(equ, reference, zeros, channels, gap);
+
+        g_assert_cmpuint(skipped, ==, decayed ? SILENCE_CHUNK : 0);
+        if (decayed)
+            break;
+        ringing++;
+    }
+    g_assert_cmpuint(ringing, >, 0);
+    g_assert_cmpuint(i, <, SILENCE_MAX_CHUNKS);
+    g_assert_cmpfloat(history_level(equ), ==, 0.0f);
+    g_assert_cmpuint(run_silence_chunk(equ, reference, zeros, channels, gap), ==, SILENCE_CHUNK);
+}
+
+/* A burst of noise and then single samples that aren't zero, each rung out
+ * before the next. silence-threshold 0 never skips.
+ */
+static void run_silence(gboolean gap) {
+    /* the left channel halfway, in the vectors is_zero() checks, and the right
+     * channel of the last frame, in the bytes after them
+     */
+    const gsize positions[] = {SILENCE_CHUNK / 2 * 2, SILENCE_CHUNK * 2 - 1};
+    guint channels = 2, i;
+    gsize n = (gsize)SILENCE_CHUNK * channels;
+    IirEqualizer* equ = fixture_new(N_BANDS, channels, 0);
+    IirEqualizer* reference = fixture_new(N_BANDS, channels, 0);
+    gfloat* noise = fixture_noise(SILENCE_CHUNK, channels, 11);
+    gfloat* zeros = g_new0(gfloat, n);
+    gfloat* impulse = g_new0(gfloat, n);
+
+    equ->silence_threshold = SILENCE_THRESHOLD_DB;
+    g_assert_cmpuint(run_silence_chunk(equ, reference, noise, channels, FALSE), ==, 0);
+    ring_out(equ, reference, zeros, channels, gap);
+
+    /* a gap is taken for silence whatever the buffer holds */
+    if (gap) {
+        gfloat* data = g_new(gfloat, n);
+
+        memcpy(data, noise, n * sizeof(gfloat));
+        g_assert_cmpuint(iir_equalizer_process_buffer(equ, (guint8*)data, NULL, channels * sizeof(gfloat), SILENCE_CHUNK, channels, equ->rate, 0, TRUE), ==,
+                         SILENCE_CHUNK);
+        g_assert_cmpmem(data, n * sizeof(gfloat), noise, n * sizeof(gfloat));
+        g_free(data);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(positions); i++) {
+        impulse[positions[i]] = 0.5f;
+        g_assert_cmpuint(run_silence_chunk(equ, reference, impulse, channels, FALSE), ==, 0);
+        impulse[positions[i]] = 0.0f;
+        ring_out(equ, reference, zeros, channels, gap);
+    }
+
+    g_free(impulse);
+    g_free(zeros);
+    g_free(noise);
+    fixture_free(reference);
+    fixture_free(equ);
+}
+
+static void test_silence_zero(void) {
+    run_silence(FALSE);
+}
+
+static void test_silence_gap(void) {
+    run_silence(TRUE);
+}
+
+/* Something with a property that can be bound, standing in for the element
+ * and the bands, which the fixture doesn't have.
+ */
+typedef struct {
+    GstObject parent;
+    gdouble value;
+} TestTarget;
+
+typedef struct {
+    GstObjectClass parent_class;
+} TestTargetClass;
+
+enum { PROP_TARGET_0, PROP_TARGET_VALUE };
+
+G_DEFINE_TYPE(TestTarget, test_target, GST_TYPE_OBJECT)
+
+static void test_target_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec) {
+    TestTarget* target = (TestTarget*)object;
+
+    switch (prop_id) {
+    case PROP_TARGET_VALUE:
+        target->value = g_value_get_double(value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void test_target_get_property(GObject* object, guint prop_id, GValue* value, GParamSpec* pspec) {
+    TestTarget* target = (TestTarget*)object;
+
+    switch (prop_id) {
+    case PROP_TARGET_VALUE:
+        g_value_set_double(value, target->value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void test_target_class_init(TestTargetClass* klass) {
+    GObjectClass* gobject_class = (GObjectClass*)klass;
+
+    gobject_class->set_property = test_target_set_property;
+    gobject_class->get_property = test_target_get_property;
+    g_object_class_install_property(gobject_class, PROP_TARGET_VALUE,
+                                    g_param_spec_double("value", "value", "bound property", 0.0, 1.0, 0.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE));
+}
+
+static void test_target_init(TestTarget* target) {}
+
+/* Records the timestamps it is synced to and publishes new coefficients at
+ * each, as a bound band property does through the sync.
+ */
+typedef struct {
+    GstControlBinding parent;
+    IirEqualizer* equ;
+    GstClockTime syncs[CONTROL_MAX_SYNCS];
+    guint n_syncs;
+} TestBinding;
+
+typedef struct {
+    GstControlBindingClass parent_class;
+} TestBindingClass;
+
+G_DEFINE_TYPE(TestBinding, test_binding, GST_TYPE_CONTROL_BINDING)
+
+/* a different gain for each sync */
+static gdouble sync_scale(guint sync) {
+    return 1.0 - 0.05 * (sync % 16);
+}
+
+static gboolean test_binding_sync_values(GstControlBinding* binding, GstObject* object, GstClockTime timestamp, GstClockTime last_sync) {
+    TestBinding* self = (TestBinding*)binding;
+
+    g_assert_cmpuint(self->n_syncs, <, CONTROL_MAX_SYNCS);
+    fixture_publish(self->equ, N_BANDS, 0, sync_scale(self->n_syncs));
+    self->syncs[self->n_syncs++] = timestamp;
+    return TRUE;
+}
+
+static void test_binding_class_init(TestBindingClass* klass) {
+    GST_CONTROL_BINDING_CLASS(klass)->sync_values = test_binding_sync_values;
+}
+
+static void test_binding_init(TestBinding* binding) {}
+
+/* A bound property is synced at the start of every chunk of
+ * control-interval frames, at the time of its first frame, and the
+ * coefficients that sync published run from that chunk on. The reference
+ * gets the same coefficients published before each chunk by hand. Without
+ * bound objects nothing is synced.
+ */
+static void test_control_interval(gconstpointer data) {
+    guint interval = GPOINTER_TO_UINT(data), channels = 2, chunk = interval > 0 ? interval : CONTROL_FRAMES, offset, i;
+    gsize n = (gsize)CONTROL_FRAMES * channels;
+    IirEqualizer* equ = fixture_new(N_BANDS, channels, 0);
+    IirEqualizer* reference = fixture_new(N_BANDS, channels, 0);
+    TestTarget* target = gst_object_ref_sink(g_object_new(test_target_get_type(), NULL));
+    TestBinding* binding = g_object_new(test_binding_get_type(), "object", target, "name", "value", NULL);
+    gfloat* expected = fixture_noise(CONTROL_FRAMES, channels, 5);
+    gfloat* actual = g_new(gfloat, n);
+
+    memcpy(actual, expected, n * sizeof(gfloat));
+    binding->equ = equ;
+    g_assert_true(gst_object_add_control_binding(GST_OBJECT(target), GST_CONTROL_BINDING(binding)));
+    equ->control_interval = interval;
+
+    /* what collect_bound_objects() and release_bound_objects() do around it */
+    equ->bound_objects[0] = gst_object_ref(target);
+    equ->n_bound_objects = 1;
+    g_assert_cmpuint(iir_equalizer_process_buffer(equ, (guint8*)actual, NULL, channels * sizeof(gfloat), CONTROL_FRAMES, channels, equ->rate, CONTROL_TIMESTAMP, FALSE), ==, 0);
+    gst_object_unref(equ->bound_objects[0]);
+    equ->n_bound_objects = 0;
+
+    g_assert_cmpuint(binding->n_syncs, ==, (CONTROL_FRAMES + chunk - 1) / chunk);
+    for (i = 0, offset = 0; offset < CONTROL_FRAMES; i++, offset += chunk) {
+        g_assert_cmpuint(binding->syncs[i], ==, CONTROL_TIMESTAMP + gst_util_uint64_scale_int(offset, GST_SECOND, equ->rate));
+        fixture_publish(reference, N_BANDS, 0, sync_scale(i));
+        run_frames(reference, expected + (gsize)offset * channels, MIN(chunk, CONTROL_FRAMES - offset), channels);
+    }
+    g_assert_cmpfloat(fixture_max_diff(expected, actual, n), ==, 0.0);
+
+    run_frames(equ, actual, CONTROL_FRAMES, channels);
+    g_assert_cmpuint(binding->n_syncs, ==, i);
+
+    gst_object_unref(target);
+    g_free(actual);
+    g_free(expected);
+    fixture_free(reference);
+    fixture_free(equ);
+}
+
+int main(int argc, char** argv) {
+    static const guint intervals[] = {0, 64, 300};
+    guint i;
+
+    gst_init(&argc, &argv);
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(variants); i++) {
+        gchar* path = g_strdup_printf("/iirequalizer/kernels/%s", variants[i].name);
+
+        g_test_add_data_func(path, &variants[i], test_variant);
+        g_free(path);
+    }
+    g_test_add_func("/iirequalizer/kernels/unrolled", test_unrolled);
+    for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+        gchar* path = g_strdup_printf("/iirequalizer/formats/%s", formats[i].name);
+
+        g_test_add_data_func(path, &formats[i], test_format);
+        g_free(path);
+    }
+    g_test_add_func("/iirequalizer/planar", test_planar);
+    g_test_add_func("/iirequalizer/ramp/continuity", test_ramp);
+    g_test_add_func("/iirequalizer/ramp/restart", test_ramp_restart);
+    g_test_add_func("/iirequalizer/num-bands/shrink", test_num_bands_shrink);
+    g_test_add_func("/iirequalizer/num-bands/grow", test_num_bands_grow);
+    g_test_add_func("/iirequalizer/silence/zero", test_silence_zero);
+    g_test_add_func("/iirequalizer/silence/gap", test_silence_gap);
+    for (i = 0; i < G_N_ELEMENTS(intervals); i++) {
+        gchar* path = g_strdup_printf("/iirequalizer/control-interval/%u", intervals[i]);
+
+        g_test_add_data_func(path, GUINT_TO_POINTER(intervals[i]), test_control_interval);
+        g_free(path);
+    }
+
+    return g_test_run();
+}
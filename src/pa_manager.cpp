@@ -1,6 +1,38 @@
 #include "pa_manager.hpp"
 
+namespace {
+
+const std::array<LatencyProfile, 3> latency_profiles = {{
+    {"ultra-low", 5000},
+    {"low", 10000},
+    {"safe", 40000},
+}};
+
+const char* default_latency_profile = "safe";
+
+} // namespace
+
+auto find_latency_profile(const std::string& name) -> const LatencyProfile* {
+    for (const auto& profile : latency_profiles) {
+        if (profile.name == name) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
+
 PAManager::PAManager() : main_loop(pa_threaded_mainloop_new()), main_loop_api(pa_threaded_mainloop_get_api(main_loop)) {
+    latency_profile = *find_latency_profile(default_latency_profile);
+    auto EQNIX_LATENCY = std::getenv("EQNIX_LATENCY");
+    if (EQNIX_LATENCY != nullptr) {
+        auto profile = find_latency_profile(EQNIX_LATENCY);
+        if (profile != nullptr) {
+            latency_profile = *profile;
+        } else {
+            logger.warn(std::string("unknown EQNIX_LATENCY ") + EQNIX_LATENCY + ", using " + latency_profile.name);
+        }
+    }
+
     pa_threaded_mainloop_lock(main_loop);
     pa_threaded_mainloop_start(main_loop);
 
@@ -104,6 +136,7 @@ void PAManager::subscribe_to_events() {
                             si->description = info->description;
                             si->rate = info->sample_spec.rate;
                             si->format = pa_sample_format_to_string(info->sample_spec.format);
+                            si->latency = info->latency;
                             if (info->active_port != nullptr) {
                                 si->active_port = info->active_port->name;
                             } else {
@@ -123,6 +156,7 @@ void PAManager::subscribe_to_events() {
                         si->description = info->description;
                         si->rate = info->sample_spec.rate;
                         si->format = pa_sample_format_to_string(info->sample_spec.format);
+                        si->latency = info->latency;
                         if (info->active_port != nullptr) {
                             si->active_port = info->active_port->name;
                         } else {
@@ -131,6 +165,7 @@ void PAManager::subscribe_to_events() {
                         if (si->name == "eqnix_apps") {
                             pm->apps_sink_info->rate = si->rate;
                             pm->apps_sink_info->format = si->format;
+                            pm->apps_sink_info->latency = si->latency;
                         }
                         Glib::signal_idle().connect_once([pm, si = move(si)] { pm->sink_changed.emit(si); });
                     }
@@ -237,6 +272,7 @@ auto PAManager::get_sink_info(const std::string& name) -> std::shared_ptr<SinkIn
             d->si->monitor_source_name = info->monitor_source_name;
             d->si->rate = info->sample_spec.rate;
             d->si->format = pa_sample_format_to_string(info->sample_spec.format);
+            d->si->latency = info->latency;
 
             if (info->active_port != nullptr) {
                 d->si->active_port = info->active_port->name;
@@ -384,8 +420,11 @@ void PAManager::load_apps_sink() {
     auto info = get_default_sink_info();
     if (info != nullptr) {
         std::string name = "eqnix_apps";
-        std::string description = "device.description=\"eqnix(apps)\"";
         auto rate = info->rate;
+        // pipewire runs the sink at this quantum, pulseaudio follows the
+        // latency pulsesrc asks of the monitor instead
+        auto quantum = static_cast<uint64_t>(latency_profile.latency_us) * rate / 1000000;
+        std::string description = "device.description=\"eqnix(apps)\"node.latency=\"" + std::to_string(quantum) + "/" + std::to_string(rate) + "\"";
         apps_sink_info = load_sink(name, description, rate);
     }
 }
@@ -427,6 +466,7 @@ void PAManager::find_sinks() {
                 si->description = info->description;
                 si->rate = info->sample_spec.rate;
                 si->format = pa_sample_format_to_string(info->sample_spec.format);
+                si->latency = info->latency;
 
                 Glib::signal_idle().connect_once([pm, si = move(si)] { pm->sink_added.emit(si); });
             }
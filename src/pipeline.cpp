@@ -1,6 +1,15 @@
 #include "pipeline.hpp"
 #include "config.h"
 #include "filter_info.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace {
 
@@ -19,18 +28,251 @@ void on_message_error(const GstBus* bus, GstMessage* message, Pipeline* p) {
     g_free(debug);
 }
 
+void on_message_latency(const GstBus* bus, GstMessage* message, Pipeline* p) {
+    gst_bin_recalculate_latency(GST_BIN(p->pipeline));
+    p->log_latency();
+}
+
+void on_message_async_done(const GstBus* bus, GstMessage* message, Pipeline* p) {
+    p->log_latency();
+    p->state_transition_finished();
+}
+
+void on_message_state_changed(const GstBus* bus, GstMessage* message, Pipeline* p) {
+    if (GST_MESSAGE_SRC(message) != GST_OBJECT(p->pipeline)) {
+        return;
+    }
+    GstState old_state;
+    GstState new_state;
+    GstState pending;
+    gst_message_parse_state_changed(message, &old_state, &new_state, &pending);
+    if (pending == GST_STATE_VOID_PENDING) {
+        p->state_transition_finished();
+    }
+}
+
+// Handled synchronously so that the suspend and resume latencies don't
+// include the wait for the main loop
+void on_state_changed(const GstBus* bus, GstMessage* message, Pipeline* p) {
+    if (GST_MESSAGE_SRC(message) != GST_OBJECT(p->pipeline)) {
+        return;
+    }
+    GstState old_state;
+    GstState new_state;
+    GstState pending;
+    gst_message_parse_state_changed(message, &old_state, &new_state, &pending);
+    p->state_reached(new_state);
+}
+
 static void message_handler(GstBus* bus, GstMessage* message, gpointer data) {
     if (std::strcmp(GST_OBJECT_NAME(message->src), "eq") == 0) {
         Equalizer* eq = static_cast<Equalizer*>(data);
         const GstStructure* s = gst_message_get_structure(message);
 
-        std::shared_ptr<FilterInfo> fc = FilterInfo::from_structure(s);
-        Glib::signal_idle().connect_once([eq, fc = move(fc)] { eq->filter_updated.emit(fc); });
+        auto updates = FilterInfo::from_structure(s);
+        if (!updates.empty()) {
+            Glib::signal_idle().connect_once([eq, updates = move(updates)] { eq->filter_updated.emit(updates); });
+        }
+    }
+};
+
+// Sample formats the equalizer processes natively, for everything else pulse
+// converts to F32LE. That includes s24-32le, which is S24_32LE with the sample
+// in the low 24 bits, not S32LE.
+std::string caps_format_from_pa(const std::string& pa_format) {
+    if (pa_format == "s16le") {
+        return "S16LE";
+    }
+    if (pa_format == "s32le") {
+        return "S32LE";
+    }
+    return "F32LE";
+}
+
+// Whether the pad template of element accepts planar audio
+bool supports_planar(GstElement* element, const char* pad_name) {
+    GstPad* pad = gst_element_get_static_pad(element, pad_name);
+    if (!pad) {
+        return false;
     }
+    GstCaps* templ = gst_pad_get_pad_template_caps(pad);
+    GstCaps* planar = gst_caps_from_string("audio/x-raw,layout=non-interleaved");
+    bool supported = gst_caps_can_intersect(templ, planar);
+    gst_caps_unref(planar);
+    gst_caps_unref(templ);
+    gst_object_unref(pad);
+    return supported;
+}
+
+// Below the default realtime priority of the pulseaudio daemon, which is 5
+constexpr int realtime_priority = 4;
+constexpr int fallback_nice = -11;
+
+// RealtimeKit hands out realtime scheduling and nice values to unprivileged
+// processes over the system bus, like it does for pulseaudio
+constexpr const char* rtkit_name = "org.freedesktop.RealtimeKit1";
+constexpr const char* rtkit_path = "/org/freedesktop/RealtimeKit1";
+constexpr int rtkit_timeout_ms = 1000;
+
+struct RtkitCall {
+    std::string method;
+    std::function<void(bool)> done;
+    Pipeline* p;
 };
 
+// Calls method of RealtimeKit without waiting for it, consuming args. done
+// gets whether it succeeded from the main loop, unless cancellable was
+// cancelled before the answer came.
+void rtkit_call(GDBusConnection* bus, const char* method, GVariant* args, GCancellable* cancellable, std::function<void(bool)> done,
+                Pipeline* p) {
+    auto call = new RtkitCall{method, std::move(done), p};
+
+    g_dbus_connection_call(bus, rtkit_name, rtkit_path, rtkit_name, method, args, nullptr, G_DBUS_CALL_FLAGS_NONE, rtkit_timeout_ms,
+                           cancellable, [](GObject* source, GAsyncResult* result, gpointer data) {
+                               std::unique_ptr<RtkitCall> call(static_cast<RtkitCall*>(data));
+                               GError* err = nullptr;
+                               GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &err);
+                               if (reply != nullptr) {
+                                   g_variant_unref(reply);
+                                   call->done(true);
+                                   return;
+                               }
+                               if (!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                                   call->p->logger.debug("RealtimeKit " + call->method + " failed: " + err->message);
+                                   call->done(false);
+                               }
+                               g_error_free(err);
+                           },
+                           call);
+}
+
+// Reads an integer property of RealtimeKit, fallback if it can't be read
+gint64 rtkit_property(GDBusConnection* bus, const char* name, gint64 fallback) {
+    GVariant* reply = g_dbus_connection_call_sync(bus, rtkit_name, rtkit_path, "org.freedesktop.DBus.Properties", "Get",
+                                                  g_variant_new("(ss)", rtkit_name, name), G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE,
+                                                  rtkit_timeout_ms, nullptr, nullptr);
+    if (reply == nullptr) {
+        return fallback;
+    }
+
+    GVariant* value;
+    g_variant_get(reply, "(v)", &value);
+    gint64 result = fallback;
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_INT64)) {
+        result = g_variant_get_int64(value);
+    } else if (g_variant_is_of_type(value, G_VARIANT_TYPE_INT32)) {
+        result = g_variant_get_int32(value);
+    }
+    g_variant_unref(value);
+    g_variant_unref(reply);
+    return result;
+}
+
+// Sets the policy of another thread of the process directly, which needs
+// RLIMIT_RTPRIO or CAP_SYS_NICE
+bool make_realtime(StreamThreadInfo& info) {
+    sched_param param{};
+    param.sched_priority = realtime_priority;
+
+    for (int policy : {SCHED_FIFO, SCHED_RR}) {
+        if (sched_setscheduler(static_cast<pid_t>(info.tid), policy, &param) == 0) {
+            info.policy = policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR";
+            info.priority = realtime_priority;
+            info.rtkit = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool make_high_priority(StreamThreadInfo& info) {
+    // on Linux the nice value of a thread id only affects that thread
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(info.tid), fallback_nice) != 0) {
+        return false;
+    }
+    info.policy = "nice";
+    info.priority = fallback_nice;
+    return true;
+}
+
+// Without RealtimeKit, or if it refused: SCHED_FIFO or SCHED_RR, then a lower
+// nice value, whichever is allowed first
+void set_scheduling_directly(StreamThreadInfo& info) {
+    if (!make_realtime(info) && !make_high_priority(info)) {
+        info.policy = "SCHED_OTHER";
+        info.priority = getpriority(PRIO_PROCESS, static_cast<id_t>(info.tid));
+    }
+}
+
+// With MCL_FUTURE every later allocation has to fit in RLIMIT_MEMLOCK or
+// fails, so a limited process doesn't lock at all rather than run out of
+// memory
+bool lock_memory(Pipeline* p) {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_MEMLOCK, &limit) != 0 || limit.rlim_cur != RLIM_INFINITY) {
+        p->logger.info("RLIMIT_MEMLOCK is limited, not locking memory");
+        return false;
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        p->logger.warn(std::string("mlockall failed: ") + std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Reads a list of CPUs like "2,3" or "2-3" into set
+bool parse_cpus(const std::string& spec, cpu_set_t& set) {
+    CPU_ZERO(&set);
+
+    const char* s = spec.c_str();
+    bool valid = true;
+    while (valid && *s != '\0') {
+        char* end;
+        long first = std::strtol(s, &end, 10);
+        long last = first;
+        valid = end != s && first >= 0;
+        if (valid && *end == '-') {
+            s = end + 1;
+            last = std::strtol(s, &end, 10);
+            valid = end != s && last >= first;
+        }
+        valid = valid && (*end == ',' || *end == '\0');
+        for (long cpu = first; valid && cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &set);
+        }
+        s = *end == ',' ? end + 1 : end;
+    }
+    return valid && CPU_COUNT(&set) != 0;
+}
+
+// Pins thread tid to the CPUs in spec, returns spec if it was applied and an
+// empty string otherwise
+std::string pin_to_cpus(const std::string& spec, long tid, Pipeline* p) {
+    cpu_set_t set;
+    parse_cpus(spec, set);
+
+    if (sched_setaffinity(static_cast<pid_t>(tid), sizeof(set), &set) != 0) {
+        p->logger.warn("could not pin thread " + std::to_string(tid) + " to cpus " + spec + ": " + std::strerror(errno));
+        return "";
+    }
+    return spec;
+}
+
+// Posted synchronously from the streaming thread, which only records its id
+// here. The scheduling is set from the main loop, the thread doesn't wait for
+// RealtimeKit or anything else before it starts.
 void on_stream_status(const GstBus* bus, GstMessage* message, Pipeline* p) {
-    // TODO: RT stuff?
+    GstStreamStatusType type;
+    GstElement* owner;
+    gst_message_parse_stream_status(message, &type, &owner);
+
+    long tid = syscall(SYS_gettid);
+
+    if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+        p->stream_thread_entered(tid, GST_ELEMENT_NAME(owner));
+    } else if (type == GST_STREAM_STATUS_TYPE_LEAVE) {
+        p->stream_thread_left(tid);
+    }
 }
 
 } // namespace
@@ -47,7 +289,11 @@ Pipeline::Pipeline(PAManager* pamanager) : pam(pamanager) {
     gst_bus_add_signal_watch(bus);
 
     g_signal_connect(bus, "message::error", G_CALLBACK(on_message_error), this);
+    g_signal_connect(bus, "message::latency", G_CALLBACK(on_message_latency), this);
+    g_signal_connect(bus, "message::async-done", G_CALLBACK(on_message_async_done), this);
+    g_signal_connect(bus, "message::state-changed", G_CALLBACK(on_message_state_changed), this);
     g_signal_connect(bus, "sync-message::stream-status", G_CALLBACK(on_stream_status), this);
+    g_signal_connect(bus, "sync-message::state-changed", G_CALLBACK(on_state_changed), this);
 
     equalizer = std::make_shared<Equalizer>();
 
@@ -68,12 +314,34 @@ Pipeline::Pipeline(PAManager* pamanager) : pam(pamanager) {
     g_object_set(sink, "mute", 0, nullptr);
     g_object_set(sink, "provide-clock", 1, nullptr);
 
+    apply_latency_profile(pam->latency_profile);
+
+    // the streaming threads are scheduled as they start, see on_stream_status
+    connect_rtkit();
+    if (lock_memory(this)) {
+        logger.info("memory locked");
+    }
+    auto EQNIX_RT_CPUS = std::getenv("EQNIX_RT_CPUS");
+    if (EQNIX_RT_CPUS != nullptr) {
+        cpu_set_t set;
+        if (parse_cpus(EQNIX_RT_CPUS, set)) {
+            rt_cpus = EQNIX_RT_CPUS;
+        } else {
+            logger.warn(std::string("ignoring invalid EQNIX_RT_CPUS: ") + EQNIX_RT_CPUS);
+        }
+    }
+
+    auto EQNIX_IDLE_TIMEOUT = std::getenv("EQNIX_IDLE_TIMEOUT");
+    if (EQNIX_IDLE_TIMEOUT != nullptr) {
+        idle_timeout = std::strtoul(EQNIX_IDLE_TIMEOUT, nullptr, 10);
+    }
+
     g_signal_connect(bus, "message::element", G_CALLBACK(message_handler), equalizer.get());
 
     std::string pulse_props = "application.id=com.github.pulse0ne.eqnix.sinkinputs";
     set_pulseaudio_props(pulse_props);
     set_source_monitor_name(pam->apps_sink_info->monitor_source_name);
-    set_caps(pam->apps_sink_info->rate);
+    set_caps(pam->apps_sink_info->rate, pam->apps_sink_info->format);
 
     auto PULSE_SINK = std::getenv("PULSE_SINK");
     if (PULSE_SINK != nullptr) {
@@ -98,6 +366,12 @@ Pipeline::Pipeline(PAManager* pamanager) : pam(pamanager) {
 Pipeline::~Pipeline() {
     set_null_pipeline();
 
+    if (rtkit_bus != nullptr) {
+        g_cancellable_cancel(rtkit_cancellable);
+        g_object_unref(rtkit_cancellable);
+        g_object_unref(rtkit_bus);
+    }
+
     gst_object_unref(bus);
     gst_object_unref(pipeline);
 }
@@ -114,7 +388,7 @@ void Pipeline::set_source_monitor_name(const std::string& name) {
     gchar* current_device;
     g_object_get(source, "current-device", &current_device, nullptr);
     if (name != current_device) {
-        if (playing) {
+        if (playing || suspended) {
             set_null_pipeline();
             g_object_set(source, "device", name.c_str(), nullptr);
             // gst_element_set_state(pipeline, GST_STATE_PLAYING);
@@ -141,20 +415,182 @@ void Pipeline::set_pulseaudio_props(const std::string& props) {
 }
 
 void Pipeline::set_null_pipeline() {
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    GstState state;
-    GstState pending;
-    gst_element_get_state(pipeline, &state, &pending, state_check_timeout);
-    if (state == GST_STATE_NULL) {
-        playing = false;
-    }
-    logger.debug(gst_element_state_get_name(state) + std::string(" -> ") + gst_element_state_get_name(pending));
+    idle_timer.disconnect();
+    reset_state(GST_STATE_NULL);
+    playing = false;
+    suspended = false;
+    logger.debug("pipeline stopped");
 }
 
 auto Pipeline::get_equalizer() -> std::shared_ptr<Equalizer> {
     return equalizer;
 }
 
+// Sizes the ring buffers of source and sink. latency-time is the segment pulse
+// is asked to deliver or take at a time, two of them make up the buffer.
+void Pipeline::apply_latency_profile(const LatencyProfile& profile) {
+    gint64 buffer_time = profile.latency_us;
+    gint64 latency_time = buffer_time / 2;
+
+    g_object_set(source, "buffer-time", buffer_time, "latency-time", latency_time, nullptr);
+    g_object_set(sink, "buffer-time", buffer_time, "latency-time", latency_time, nullptr);
+    logger.debug("latency profile " + profile.name + ": buffer-time " + std::to_string(buffer_time) + " us, latency-time " + std::to_string(latency_time) + " us");
+}
+
+// The total runs from an app writing to eqnix_apps to pulsesink handing the
+// audio to the output device: the apps sink, capture and processing as the
+// latency query reports them, and the ring buffer of pulsesink.
+void Pipeline::log_latency() {
+    GstQuery* query = gst_query_new_latency();
+    if (gst_element_query(pipeline, query)) {
+        gboolean live;
+        GstClockTime min_latency;
+        GstClockTime max_latency;
+        gst_query_parse_latency(query, &live, &min_latency, &max_latency);
+
+        uint64_t pipeline_us = GST_TIME_AS_USECONDS(min_latency);
+        uint64_t apps_sink_us = pam->apps_sink_info ? pam->apps_sink_info->latency : 0;
+        uint64_t total_us = apps_sink_us + pipeline_us + pam->latency_profile.latency_us;
+        logger.debug("pipeline latency " + std::to_string(pipeline_us) + " us, total " + std::to_string(total_us) + " us");
+    }
+    gst_query_unref(query);
+}
+
+// Connects to RealtimeKit and reads its limits once, at startup. rtkit_bus
+// stays unset if it isn't running or doesn't hand out realtime scheduling.
+void Pipeline::connect_rtkit() {
+    GError* err = nullptr;
+    GDBusConnection* bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, nullptr, &err);
+    if (bus == nullptr) {
+        logger.debug(std::string("no system bus for RealtimeKit: ") + err->message);
+        g_error_free(err);
+        return;
+    }
+
+    rtkit_max_priority = static_cast<int>(std::min<gint64>(realtime_priority, rtkit_property(bus, "MaxRealtimePriority", 0)));
+    rtkit_min_nice = static_cast<int>(std::max<gint64>(fallback_nice, rtkit_property(bus, "MinNiceLevel", fallback_nice)));
+    rtkit_rttime_usec = rtkit_property(bus, "RTTimeUSecMax", 0);
+    if (rtkit_max_priority <= 0 || rtkit_rttime_usec <= 0) {
+        logger.debug("RealtimeKit is not available");
+        g_object_unref(bus);
+        return;
+    }
+
+    rtkit_bus = bus;
+    rtkit_cancellable = g_cancellable_new();
+}
+
+// RealtimeKit only makes threads realtime in a process that gets killed when
+// one of them runs for longer than RTTimeUSecMax, 200 ms by default, without
+// blocking. The hard limit can't be raised again, so it is set once
+// RealtimeKit has granted a nice value and not before. It holds for every
+// realtime thread, the pool workers of the equalizer included, they block
+// between buffers like the streaming threads.
+auto Pipeline::limit_rttime() -> bool {
+    if (rttime_limited) {
+        return true;
+    }
+
+    rlimit limit{};
+    if (getrlimit(RLIMIT_RTTIME, &limit) != 0) {
+        return false;
+    }
+    if (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > static_cast<rlim_t>(rtkit_rttime_usec)) {
+        limit.rlim_cur = limit.rlim_max = static_cast<rlim_t>(rtkit_rttime_usec);
+        if (setrlimit(RLIMIT_RTTIME, &limit) != 0) {
+            logger.warn(std::string("could not limit RLIMIT_RTTIME for RealtimeKit: ") + std::strerror(errno));
+            return false;
+        }
+    }
+    rttime_limited = true;
+    return true;
+}
+
+void Pipeline::stream_thread_entered(long tid, const std::string& element) {
+    {
+        std::lock_guard<std::mutex> lock(stream_threads_mutex);
+        stream_threads.push_back(tid);
+    }
+
+    StreamThreadInfo info;
+    info.element = element;
+    info.tid = tid;
+    Glib::signal_idle().connect_once([this, info] { schedule_stream_thread(info); });
+}
+
+void Pipeline::stream_thread_left(long tid) {
+    std::lock_guard<std::mutex> lock(stream_threads_mutex);
+    stream_threads.erase(std::remove(stream_threads.begin(), stream_threads.end(), tid), stream_threads.end());
+}
+
+// Thread ids are reused, nothing is done to a thread that left in the meantime
+auto Pipeline::stream_thread_alive(long tid) -> bool {
+    std::lock_guard<std::mutex> lock(stream_threads_mutex);
+    return std::find(stream_threads.begin(), stream_threads.end(), tid) != stream_threads.end();
+}
+
+// Asks RealtimeKit for a nice value first, which shows that it is there and
+// accepts the process, then for realtime scheduling. Threads it made
+// realtime run SCHED_RR. Whatever it refuses is tried directly.
+void Pipeline::schedule_stream_thread(StreamThreadInfo info) {
+    if (!stream_thread_alive(info.tid)) {
+        return;
+    }
+    if (!rt_cpus.empty()) {
+        info.cpus = pin_to_cpus(rt_cpus, info.tid, this);
+    }
+    if (rtkit_bus == nullptr) {
+        set_scheduling_directly(info);
+        stream_thread_scheduled(info);
+        return;
+    }
+
+    auto args = g_variant_new("(ti)", static_cast<guint64>(info.tid), static_cast<gint32>(rtkit_min_nice));
+    rtkit_call(rtkit_bus, "MakeThreadHighPriority", args, rtkit_cancellable, [this, info](bool granted) mutable {
+        if (!stream_thread_alive(info.tid)) {
+            return;
+        }
+        if (!granted) {
+            set_scheduling_directly(info);
+            stream_thread_scheduled(info);
+            return;
+        }
+        info.policy = "nice";
+        info.priority = rtkit_min_nice;
+        info.rtkit = true;
+        rtkit_make_realtime(info);
+    }, this);
+}
+
+// A thread RealtimeKit only gave a nice value to keeps it if it can't be made
+// realtime directly either
+void Pipeline::rtkit_make_realtime(StreamThreadInfo info) {
+    if (!limit_rttime()) {
+        make_realtime(info);
+        stream_thread_scheduled(info);
+        return;
+    }
+
+    auto args = g_variant_new("(tu)", static_cast<guint64>(info.tid), static_cast<guint32>(rtkit_max_priority));
+    rtkit_call(rtkit_bus, "MakeThreadRealtime", args, rtkit_cancellable, [this, info](bool granted) mutable {
+        if (!stream_thread_alive(info.tid)) {
+            return;
+        }
+        if (granted) {
+            info.policy = "SCHED_RR";
+            info.priority = rtkit_max_priority;
+        } else {
+            make_realtime(info);
+        }
+        stream_thread_scheduled(info);
+    }, this);
+}
+
+void Pipeline::stream_thread_scheduled(const StreamThreadInfo& info) {
+    logger.info("streaming thread " + std::to_string(info.tid) + " of " + info.element + ": " + info.policy + " " + std::to_string(info.priority) +
+                (info.rtkit ? " from RealtimeKit" : "") + (info.cpus.empty() ? "" : ", cpus " + info.cpus));
+}
+
 auto Pipeline::apps_want_to_play() -> bool {
     bool wants_to_play = false;
     for (auto& a : apps_list) {
@@ -166,21 +602,139 @@ auto Pipeline::apps_want_to_play() -> bool {
     return wants_to_play;
 }
 
+// Plays while some app wants to, otherwise waits idle_timeout and suspends
 void Pipeline::update_pipeline_state() {
+    if (apps_want_to_play()) {
+        idle_timer.disconnect();
+        request_state(GST_STATE_PLAYING);
+        playing = true;
+        suspended = false;
+    } else if (requested_state == GST_STATE_PLAYING && idle_timeout > 0 && !idle_timer.connected()) {
+        idle_timer = Glib::signal_timeout().connect([this] {
+            suspend_pipeline();
+            return false;
+        }, idle_timeout);
+    }
+}
+
+void Pipeline::suspend_pipeline() {
+    if (apps_want_to_play()) {
+        return;
+    }
+    logger.debug("no app played for " + std::to_string(idle_timeout) + " ms, suspending");
+    request_state(idle_state);
+    playing = false;
+    suspended = true;
+}
+
+// The state is applied from the main loop once the events at hand are
+// handled, a burst of app events ends up as a single transition
+void Pipeline::request_state(GstState state) {
+    requested_state = state;
+    if (!state_idle.connected()) {
+        state_idle = Glib::signal_idle().connect([this] {
+            apply_requested_state();
+            return false;
+        });
+    }
+}
+
+// Starts the transition to requested_state unless one is in flight, which
+// picks up the request when it finishes. Never waits for the pipeline.
+void Pipeline::apply_requested_state() {
+    if (transition_target != GST_STATE_VOID_PENDING) {
+        return;
+    }
+
     GstState state;
     GstState pending;
-    gst_element_get_state(pipeline, &state, &pending, state_check_timeout);
-    if (state != GST_STATE_PLAYING) {
-        gst_element_set_state(pipeline, GST_STATE_PLAYING);
-        playing = true;
+    gst_element_get_state(pipeline, &state, &pending, 0);
+    if (state == requested_state && pending == GST_STATE_VOID_PENDING) {
+        return;
+    }
+
+    if (requested_state == GST_STATE_PLAYING) {
+        suspend_requested = 0;
+        resume_requested = g_get_monotonic_time();
+    } else if (requested_state == idle_state) {
+        suspend_requested = g_get_monotonic_time();
     }
+
+    transition_target = requested_state;
+    logger.debug(std::string("changing state to ") + gst_element_state_get_name(requested_state));
+
+    switch (gst_element_set_state(pipeline, requested_state)) {
+    case GST_STATE_CHANGE_ASYNC:
+        // finished by ASYNC_DONE or the last STATE_CHANGED, or retried if neither comes
+        transition_timer = Glib::signal_timeout().connect([this] {
+            logger.warn(std::string("state change to ") + gst_element_state_get_name(transition_target) + " is taking too long, retrying");
+            transition_target = GST_STATE_VOID_PENDING;
+            apply_requested_state();
+            return false;
+        }, state_check_timeout);
+        break;
+    case GST_STATE_CHANGE_FAILURE:
+        logger.warn(std::string("could not change state to ") + gst_element_state_get_name(requested_state));
+        transition_target = GST_STATE_VOID_PENDING;
+        break;
+    default:
+        transition_target = GST_STATE_VOID_PENDING;
+        break;
+    }
+}
+
+void Pipeline::state_transition_finished() {
+    if (transition_target == GST_STATE_VOID_PENDING) {
+        return;
+    }
+
+    GstState state;
+    GstState pending;
+    gst_element_get_state(pipeline, &state, &pending, 0);
+    if (pending != GST_STATE_VOID_PENDING) {
+        return;
+    }
+
+    transition_timer.disconnect();
+    transition_target = GST_STATE_VOID_PENDING;
+    if (state != requested_state) {
+        request_state(requested_state);
+    }
+}
+
+// Changes down to READY or NULL finish before set_state returns, they are
+// done right away and replace anything requested or in flight
+void Pipeline::reset_state(GstState state) {
+    state_idle.disconnect();
+    transition_timer.disconnect();
+    transition_target = GST_STATE_VOID_PENDING;
+    requested_state = state;
+    gst_element_set_state(pipeline, state);
 }
 
-void Pipeline::set_caps(const uint& sampling_rate) {
+void Pipeline::state_reached(GstState state) {
+    gint64 now = g_get_monotonic_time();
+    gint64 requested;
+
+    if (state == GST_STATE_PLAYING && (requested = resume_requested.exchange(0)) != 0) {
+        logger.debug("resumed in " + std::to_string(now - requested) + " us");
+    } else if (state == idle_state && (requested = suspend_requested.exchange(0)) != 0) {
+        logger.debug("suspended in " + std::to_string(now - requested) + " us");
+    }
+}
+
+void Pipeline::set_caps(const uint& sampling_rate, const std::string& format) {
     logger.debug(std::to_string(current_rate));
     current_rate = sampling_rate;
-    logger.debug(std::to_string(current_rate));
-    auto caps_str = "audio/x-raw,format=F32LE,channels=2,rate=" + std::to_string(sampling_rate);
+    current_format = format;
+    logger.debug(std::to_string(current_rate) + " " + format);
+    auto caps_format = caps_format_from_pa(format);
+    // the equalizer takes planar F32 as is, but that only helps if source and sink do too
+    std::string layout = "interleaved";
+    if (caps_format == "F32LE" && supports_planar(source, "src") && supports_planar(sink, "sink")) {
+        layout = "non-interleaved";
+    }
+    auto caps_str = "audio/x-raw,format=" + caps_format + ",layout=" + layout + ",channels=2,rate=" + std::to_string(sampling_rate);
     auto caps = gst_caps_from_string(caps_str.c_str());
     g_object_set(capsfilter, "caps", caps, nullptr);
     gst_caps_unref(caps);
@@ -213,9 +767,9 @@ void Pipeline::on_app_removed(uint idx) {
 
 void Pipeline::on_sink_changed(const std::shared_ptr<SinkInfo>& sink_info) {
     if (sink_info->name == "eqnix_apps") {
-        if (sink_info->rate != current_rate) {
-            gst_element_set_state(pipeline, GST_STATE_READY);
-            set_caps(sink_info->rate);
+        if (sink_info->rate != current_rate || sink_info->format != current_format) {
+            reset_state(GST_STATE_READY);
+            set_caps(sink_info->rate, sink_info->format);
             update_pipeline_state();
         }
     }
@@ -223,9 +777,9 @@ void Pipeline::on_sink_changed(const std::shared_ptr<SinkInfo>& sink_info) {
 
 void Pipeline::on_source_changed(const std::shared_ptr<SourceInfo>& source_info) {
     if (source_info->name == "eqnix_mic.monitor") {
-        if (source_info->rate != current_rate) {
-            gst_element_set_state(pipeline, GST_STATE_READY);
-            set_caps(source_info->rate);
+        if (source_info->rate != current_rate || source_info->format != current_format) {
+            reset_state(GST_STATE_READY);
+            set_caps(source_info->rate, source_info->format);
             update_pipeline_state();
         }
     }